@@ -0,0 +1,87 @@
+/**
+ * Copyright 2021 Michele Riva
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#include <asyncsmp_io.h>
+#include <esp_log.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Build for the Linux target to run without hardware: idf.py --preview set-target linux
+
+#define BLOCKS 8
+#define BLOCK_SIZE 64
+
+// Main program execution
+void app_main(void)
+{
+    // Create the I/O engine, and open a file
+    asyncsmp_io_t *io = asyncsmp_io_create(16, 4096, 5);
+    int fd = open("/tmp/asyncsmp-example.bin", O_RDWR | O_CREAT | O_TRUNC, 0600);
+
+    // Write adjacent blocks, then flush: writes are merged into a single call
+    static char blocks[BLOCKS][BLOCK_SIZE];
+    asyncsmp_req_t *reqs[BLOCKS + 1];
+    for (int i = 0; i < BLOCKS; i++)
+    {
+        memset(blocks[i], 'a' + i, BLOCK_SIZE);
+        reqs[i] = asyncsmp_req_alloc_sem(sizeof(asyncsmp_io_op_t));
+        *(asyncsmp_io_op_t *)reqs[i]->data = (asyncsmp_io_op_t){
+            .type = ASYNCSMP_IO_WRITE,
+            .fd = fd,
+            .buf = blocks[i],
+            .len = BLOCK_SIZE,
+            .offset = i * BLOCK_SIZE};
+    }
+    reqs[BLOCKS] = asyncsmp_req_alloc_sem(sizeof(asyncsmp_io_op_t));
+    *(asyncsmp_io_op_t *)reqs[BLOCKS]->data = (asyncsmp_io_op_t){
+        .type = ASYNCSMP_IO_FLUSH,
+        .fd = fd};
+    for (int i = 0; i <= BLOCKS; i++)
+        asyncsmp_io_submit(io, reqs[i], portMAX_DELAY);
+
+    // Do something else while the I/O engine works (optional)
+    ESP_LOGI("APP_MAIN", "Doing something else while writing");
+
+    // Await until all operations complete
+    asyncsmp_await_all(reqs, BLOCKS + 1, portMAX_DELAY);
+    for (int i = 0; i <= BLOCKS; i++)
+    {
+        ESP_LOGI("APP_MAIN", "Operation %d complete (result: %d, bytes: %d)", i, reqs[i]->ret, (int)((asyncsmp_io_op_t *)reqs[i]->data)->result);
+        asyncsmp_req_free_sem(reqs[i]);
+    }
+
+    // Read a block back
+    char block[BLOCK_SIZE];
+    asyncsmp_req_t *req = asyncsmp_req_alloc_sem(sizeof(asyncsmp_io_op_t));
+    *(asyncsmp_io_op_t *)req->data = (asyncsmp_io_op_t){
+        .type = ASYNCSMP_IO_READ,
+        .fd = fd,
+        .buf = block,
+        .len = BLOCK_SIZE,
+        .offset = 3 * BLOCK_SIZE};
+    asyncsmp_io_submit(io, req, portMAX_DELAY);
+    asyncsmp_await_sem(req, portMAX_DELAY);
+    ESP_LOGI("APP_MAIN", "Read block 3 (result: %d, first byte: %c)", req->ret, block[0]);
+    asyncsmp_req_free_sem(req);
+
+    // Check how many calls were needed
+    asyncsmp_io_stats_t stats;
+    asyncsmp_io_stats(io, &stats);
+    ESP_LOGI("APP_MAIN", "%u operations in %u batches, %u calls", (unsigned)stats.ops, (unsigned)stats.batches, (unsigned)stats.calls);
+
+    // Done, free resources
+    close(fd);
+    asyncsmp_io_delete(io);
+}
@@ -0,0 +1,498 @@
+/**
+ * Copyright 2021 Michele Riva
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#include <asyncsmp.h>
+#include <esp_log.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if CONFIG_IDF_TARGET_LINUX
+#include <malloc.h>
+#else
+#include <esp_heap_caps.h>
+#endif
+
+// Runs on any target, soaks are best run on the Linux target: idf.py --preview set-target linux
+
+// Topology
+#define REQUESTERS 4        // Requester tasks
+#define SLOTS 8             // Requests each requester keeps in flight at most, each awaited by its own slot task
+#define RECEIVERS 4         // Receiver tasks
+#define CHAIN_DEPTH 2       // Receivers a request goes through before being served (1 to disable chaining)
+#define QUEUE_LEN 128       // Receiver queue length, holding all messages in flight as receivers forward to each other
+#define BACKLOG_LEN 512     // Scheduled requests waiting for a free slot, per requester
+
+_Static_assert(QUEUE_LEN >= 2 * REQUESTERS * SLOTS * CHAIN_DEPTH, "Receiver queues could fill up in a cycle");
+
+// Load, arriving at a fixed rate regardless of how fast requests complete (open loop)
+#define RATE_HZ 500         // Requests per second, per requester
+#define SERVICE_US 100      // Time spent serving a request
+#define SLOW_PERMILLE 5     // Requests served slowly, per thousand
+#define SLOW_FACTOR 50      // Service time multiplier of slow requests
+#define DURATION_S 3600     // Test duration
+#define REPORT_S 10         // Reporting interval
+
+// Request mix (relative weights): semaphore, task notification, queue message, event group, asyncsmp_exec
+static const uint32_t mix[] = {4, 2, 2, 1, 1};
+static const char *mix_names[] = {"sem", "tn", "qmsg", "eg", "exec"};
+#define MIX_TYPES (sizeof(mix) / sizeof(mix[0]))
+
+// Completion bit of event group requests
+#define EG_DONE_BIT 0x01
+
+// Message types
+typedef enum
+{
+    RECEIVER_WORK,
+    RECEIVER_CHILD_DONE,
+    REQUESTER_DONE
+} msg_t;
+
+// Data carried by requests
+typedef struct
+{
+    uint32_t hops;
+    uint32_t service_us;
+} work_t;
+
+/**
+ * Latency histogram, in microseconds
+ *
+ * Log-linear buckets (8 per power of two) keep the relative error under 12.5% from 1us to over an hour.
+ * Histograms are shared by the slot tasks of a requester, so they are updated and read atomically.
+ */
+#define HIST_BUCKETS 240
+typedef struct
+{
+    uint32_t counts[HIST_BUCKETS];
+    uint32_t max;
+} hist_t;
+
+static size_t hist_bucket(uint32_t us)
+{
+    if (us < 16)
+        return us;
+    uint32_t shift = 31 - __builtin_clz(us) - 3;
+    return shift * 8 + (us >> shift);
+}
+
+static uint32_t hist_bucket_max(size_t bucket)
+{
+    if (bucket < 16)
+        return bucket;
+    uint32_t shift = bucket / 8 - 1;
+    return (((uint64_t)(bucket % 8 + 9)) << shift) - 1;
+}
+
+static void hist_record(hist_t *hist, int64_t us)
+{
+    uint32_t value = us < 0 ? 0 : us > UINT32_MAX ? UINT32_MAX : (uint32_t)us;
+    __atomic_fetch_add(&hist->counts[hist_bucket(value)], 1, __ATOMIC_RELAXED);
+    uint32_t max = __atomic_load_n(&hist->max, __ATOMIC_RELAXED);
+    while (value > max && !__atomic_compare_exchange_n(&hist->max, &max, value, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+// Percentiles are given in hundredths of percent (9990 for p99.9)
+static uint32_t hist_percentile(const uint32_t *counts, uint64_t total, uint32_t pct100)
+{
+    uint64_t rank = (total * pct100 + 9999) / 10000;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < HIST_BUCKETS; i++)
+    {
+        seen += counts[i];
+        if (seen && seen >= rank)
+            return hist_bucket_max(i);
+    }
+    return 0;
+}
+
+static int64_t now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void serve(uint32_t service_us)
+{
+    int64_t until = now_us() + service_us;
+    while (now_us() < until)
+        ;
+}
+
+// Receivers, serving requests or forwarding them down the chain
+static QueueHandle_t receiver_queues[RECEIVERS];
+static void receiver(void *args)
+{
+    size_t id = (size_t)args;
+    asyncsmp_msg_t msg;
+    while (true)
+    {
+        xQueueReceive(receiver_queues[id], &msg, portMAX_DELAY);
+        asyncsmp_req_t *req = (asyncsmp_req_t *)msg.data;
+        switch (msg.type)
+        {
+        case RECEIVER_WORK:
+        {
+            UBaseType_t prio = asyncsmp_prio_boost(req);
+            work_t *work = (work_t *)req->data;
+            if (work->hops > 1)
+            {
+                // Forward a child request to the next receiver, its response comes back here
+                asyncsmp_req_t *child = asyncsmp_req_alloc_qmsg(receiver_queues[id], RECEIVER_CHILD_DONE, NULL, sizeof(work_t));
+                child->parent = req;
+                ((work_t *)child->data)->hops = work->hops - 1;
+                ((work_t *)child->data)->service_us = work->service_us;
+                asyncsmp_msg_t fwd = {
+                    .type = RECEIVER_WORK,
+                    .data = child};
+                xQueueSendToBack(receiver_queues[(id + 1) % RECEIVERS], &fwd, portMAX_DELAY);
+            }
+            else
+            {
+                serve(work->service_us);
+                asyncsmp_cb(req, 0);
+            }
+            asyncsmp_prio_restore(prio);
+            break;
+        }
+        case RECEIVER_CHILD_DONE:
+        {
+            asyncsmp_cb(req->parent, req->ret);
+            asyncsmp_req_free_qmsg(req);
+            break;
+        }
+        default:
+            ESP_LOGE("RECEIVER", "Unknown message type");
+        }
+    }
+}
+
+// Asynchronous function, serving requests of type exec
+static void exec_serve(asyncsmp_req_t *req)
+{
+    serve(((work_t *)req->data)->service_us);
+    asyncsmp_cb(req, 0);
+}
+
+// Requesters, scheduling requests at a fixed rate and handing them to their slots
+typedef struct
+{
+    int64_t intended;
+    size_t type;
+    size_t receiver;
+    uint32_t service_us;
+} job_t;
+
+typedef struct
+{
+    size_t id;
+    QueueHandle_t backlog;
+    uint32_t rng;
+    hist_t corrected;
+    hist_t service;
+    uint32_t sent[MIX_TYPES];
+    uint32_t late;
+} requester_t;
+
+// Slots, each sending one request at a time and awaiting it
+typedef struct
+{
+    requester_t *owner;
+    QueueHandle_t queue;
+    EventGroupHandle_t eg;
+} slot_t;
+
+static requester_t requesters[REQUESTERS];
+static slot_t slots[REQUESTERS][SLOTS];
+static volatile bool stop;
+static SemaphoreHandle_t stopped;
+
+static uint32_t xorshift(uint32_t *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+static size_t pick_type(requester_t *self)
+{
+    uint32_t total = 0;
+    for (size_t i = 0; i < MIX_TYPES; i++)
+        total += mix[i];
+    uint32_t pick = xorshift(&self->rng) % total;
+    size_t type = 0;
+    while (pick >= mix[type])
+        pick -= mix[type++];
+    return type;
+}
+
+static void send_work(size_t receiver, asyncsmp_req_t *req)
+{
+    asyncsmp_msg_t msg = {
+        .type = RECEIVER_WORK,
+        .data = req};
+    xQueueSendToBack(receiver_queues[receiver], &msg, portMAX_DELAY);
+}
+
+static void slot(void *args)
+{
+    slot_t *self = (slot_t *)args;
+    requester_t *owner = self->owner;
+    const int64_t tick_us = 1000000 / configTICK_RATE_HZ;
+    job_t job;
+
+    while (xQueueReceive(owner->backlog, &job, portMAX_DELAY) && job.type < MIX_TYPES)
+    {
+        work_t work = {
+            .hops = CHAIN_DEPTH,
+            .service_us = job.service_us};
+
+        // Requests waiting for a free slot are sent late, the wait is charged to their corrected latency
+        int64_t sent = now_us();
+        if (sent - job.intended > tick_us)
+            __atomic_fetch_add(&owner->late, 1, __ATOMIC_RELAXED);
+
+        asyncsmp_req_t *req = NULL;
+        switch (job.type)
+        {
+        case 0:
+            req = asyncsmp_req_alloc_sem(sizeof(work_t));
+            *(work_t *)req->data = work;
+            send_work(job.receiver, req);
+            asyncsmp_await_sem(req, portMAX_DELAY);
+            asyncsmp_req_free_sem(req);
+            break;
+        case 1:
+            req = asyncsmp_req_alloc_tn(sizeof(work_t));
+            *(work_t *)req->data = work;
+            send_work(job.receiver, req);
+            asyncsmp_await_tn(portMAX_DELAY);
+            asyncsmp_req_free_tn(req);
+            break;
+        case 2:
+        {
+            asyncsmp_msg_t msg;
+            req = asyncsmp_req_alloc_qmsg(self->queue, REQUESTER_DONE, NULL, sizeof(work_t));
+            *(work_t *)req->data = work;
+            send_work(job.receiver, req);
+            xQueueReceive(self->queue, &msg, portMAX_DELAY);
+            asyncsmp_req_free_qmsg((asyncsmp_req_t *)msg.data);
+            break;
+        }
+        case 3:
+            req = asyncsmp_req_alloc_eg(self->eg, EG_DONE_BIT, sizeof(work_t));
+            *(work_t *)req->data = work;
+            send_work(job.receiver, req);
+            asyncsmp_await_eg_all(self->eg, EG_DONE_BIT, portMAX_DELAY);
+            asyncsmp_req_free_eg(req);
+            break;
+        default:
+            req = asyncsmp_req_alloc_sem(sizeof(work_t));
+            *(work_t *)req->data = work;
+            asyncsmp_exec(exec_serve, req, ASYNCSMP_STACK_AUTO, uxTaskPriorityGet(NULL));
+            asyncsmp_await_sem(req, portMAX_DELAY);
+            asyncsmp_req_free_sem(req);
+        }
+
+        // Corrected latency runs from the intended send time, service latency from the actual one
+        int64_t done = now_us();
+        hist_record(&owner->corrected, done - job.intended);
+        hist_record(&owner->service, done - sent);
+        __atomic_fetch_add(&owner->sent[job.type], 1, __ATOMIC_RELAXED);
+    }
+
+    xSemaphoreGive(stopped);
+    vTaskDelete(NULL);
+}
+
+static void requester(void *args)
+{
+    requester_t *self = (requester_t *)args;
+    const int64_t interval = 1000000 / RATE_HZ;
+    const int64_t tick_us = 1000000 / configTICK_RATE_HZ;
+    int64_t intended = now_us();
+
+    // Requests are scheduled whether or not earlier ones completed. When behind schedule, they are
+    // handed over right away: the delay is accounted for, since latency is measured from the intended time.
+    for (uint64_t n = 0; !stop; n++, intended += interval)
+    {
+        int64_t now;
+        while ((now = now_us()) < intended)
+        {
+            if (intended - now > tick_us)
+                vTaskDelay(1);
+            else
+                taskYIELD();
+        }
+
+        job_t job = {
+            .intended = intended,
+            .type = pick_type(self),
+            .receiver = (self->id + n) % RECEIVERS,
+            .service_us = xorshift(&self->rng) % 1000 < SLOW_PERMILLE ? SERVICE_US * SLOW_FACTOR : SERVICE_US};
+        xQueueSendToBack(self->backlog, &job, portMAX_DELAY);
+    }
+
+    // Let the slots drain the backlog, then stop them
+    job_t end = {.type = MIX_TYPES};
+    for (size_t i = 0; i < SLOTS; i++)
+        xQueueSendToBack(self->backlog, &end, portMAX_DELAY);
+    vTaskDelete(NULL);
+}
+
+// Reporting
+typedef struct
+{
+    uint32_t corrected[HIST_BUCKETS];
+    uint32_t service[HIST_BUCKETS];
+    uint32_t sent[MIX_TYPES];
+    uint32_t late;
+} snapshot_t;
+
+static void snapshot(snapshot_t *snap)
+{
+    memset(snap, 0, sizeof(snapshot_t));
+    for (size_t r = 0; r < REQUESTERS; r++)
+    {
+        for (size_t i = 0; i < HIST_BUCKETS; i++)
+        {
+            snap->corrected[i] += __atomic_load_n(&requesters[r].corrected.counts[i], __ATOMIC_RELAXED);
+            snap->service[i] += __atomic_load_n(&requesters[r].service.counts[i], __ATOMIC_RELAXED);
+        }
+        for (size_t i = 0; i < MIX_TYPES; i++)
+            snap->sent[i] += __atomic_load_n(&requesters[r].sent[i], __ATOMIC_RELAXED);
+        snap->late += __atomic_load_n(&requesters[r].late, __ATOMIC_RELAXED);
+    }
+}
+
+static void report_latency(const char *name, const uint32_t *counts, uint64_t total)
+{
+    ESP_LOGI("LOADGEN", "  %-9s p50 %7uus  p99 %7uus  p99.9 %7uus  p99.99 %7uus", name,
+             (unsigned)hist_percentile(counts, total, 5000), (unsigned)hist_percentile(counts, total, 9900),
+             (unsigned)hist_percentile(counts, total, 9990), (unsigned)hist_percentile(counts, total, 9999));
+}
+
+static void report_heap(size_t *baseline)
+{
+    // Fragmentation is the share of free memory outside of the largest free block, or on Linux,
+    // where the largest block is unknown, the share of the heap held free by the allocator
+#if CONFIG_IDF_TARGET_LINUX
+    struct mallinfo2 info = mallinfo2();
+    size_t used = info.uordblks + info.hblkhd;
+    size_t free_bytes = info.fordblks;
+    unsigned fragmentation = info.arena ? 100 * (uint64_t)info.fordblks / info.arena : 0;
+#else
+    size_t free_bytes = heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
+    size_t used = heap_caps_get_total_size(MALLOC_CAP_DEFAULT) - free_bytes;
+    size_t largest = heap_caps_get_largest_free_block(MALLOC_CAP_DEFAULT);
+    unsigned fragmentation = free_bytes ? 100 - 100 * (uint64_t)largest / free_bytes : 0;
+#endif
+    if (!*baseline)
+        *baseline = used;
+    asyncsmp_reclaim_stats_t reclaim;
+    asyncsmp_reclaim_stats(&reclaim);
+    ESP_LOGI("LOADGEN", "  heap used %u (%+d since start), free %u, fragmentation %u%%, pending reclaim %u",
+             (unsigned)used, (int)(used - *baseline), (unsigned)free_bytes, fragmentation,
+             (unsigned)(reclaim.retired - reclaim.reclaimed));
+}
+
+// Main program execution
+void app_main(void)
+{
+#if CONFIG_IDF_TARGET_LINUX
+    // Tasks are threads, keep them all in the main arena so that heap statistics cover them
+    mallopt(M_ARENA_MAX, 1);
+#endif
+    ESP_LOGI("LOADGEN", "%d requesters at %dHz with %d slots each, %d receivers, chain depth %d, %ds", REQUESTERS, RATE_HZ, SLOTS, RECEIVERS, CHAIN_DEPTH, DURATION_S);
+
+    // Receivers run above slots, so that queues drain, and requesters above both, so that they stay on schedule
+    for (size_t i = 0; i < RECEIVERS; i++)
+    {
+        receiver_queues[i] = xQueueCreate(QUEUE_LEN, sizeof(asyncsmp_msg_t));
+        xTaskCreate(receiver, "receiver", 4096, (void *)i, 6, NULL);
+    }
+
+    size_t heap_baseline = 0;
+    report_heap(&heap_baseline);
+
+    stopped = xSemaphoreCreateCounting(REQUESTERS * SLOTS, 0);
+    for (size_t i = 0; i < REQUESTERS; i++)
+    {
+        requesters[i].id = i;
+        requesters[i].backlog = xQueueCreate(BACKLOG_LEN, sizeof(job_t));
+        requesters[i].rng = 0x9E3779B9u * (i + 1);
+        for (size_t j = 0; j < SLOTS; j++)
+        {
+            slots[i][j].owner = &requesters[i];
+            slots[i][j].queue = xQueueCreate(1, sizeof(asyncsmp_msg_t));
+            slots[i][j].eg = xEventGroupCreate();
+            xTaskCreate(slot, "slot", 4096, &slots[i][j], 5, NULL);
+        }
+        xTaskCreate(requester, "requester", 4096, &requesters[i], 7, NULL);
+    }
+
+    // Report every interval, and over the whole run at the end
+    static snapshot_t prev, cur, delta;
+    int64_t last = now_us();
+    for (int elapsed = REPORT_S; elapsed <= DURATION_S; elapsed += REPORT_S)
+    {
+        vTaskDelay(pdMS_TO_TICKS(REPORT_S * 1000));
+        snapshot(&cur);
+        int64_t now = now_us();
+        uint64_t total = 0;
+        for (size_t i = 0; i < HIST_BUCKETS; i++)
+        {
+            delta.corrected[i] = cur.corrected[i] - prev.corrected[i];
+            delta.service[i] = cur.service[i] - prev.service[i];
+            total += delta.corrected[i];
+        }
+        ESP_LOGI("LOADGEN", "[%5ds] %u req/s (target %d), %u late sends", elapsed,
+                 (unsigned)(total * 1000000 / (now - last)), REQUESTERS * RATE_HZ, (unsigned)(cur.late - prev.late));
+        report_latency("corrected", delta.corrected, total);
+        report_latency("service", delta.service, total);
+        report_heap(&heap_baseline);
+        prev = cur;
+        last = now;
+    }
+
+    stop = true;
+    for (size_t i = 0; i < REQUESTERS * SLOTS; i++)
+        xSemaphoreTake(stopped, portMAX_DELAY);
+
+    snapshot(&cur);
+    uint64_t total = 0;
+    uint32_t corrected_max = 0, service_max = 0;
+    for (size_t i = 0; i < HIST_BUCKETS; i++)
+        total += cur.corrected[i];
+    for (size_t r = 0; r < REQUESTERS; r++)
+    {
+        corrected_max = requesters[r].corrected.max > corrected_max ? requesters[r].corrected.max : corrected_max;
+        service_max = requesters[r].service.max > service_max ? requesters[r].service.max : service_max;
+    }
+    ESP_LOGI("LOADGEN", "Done, %llu requests (%u late sends)", (unsigned long long)total, (unsigned)cur.late);
+    for (size_t i = 0; i < MIX_TYPES; i++)
+        ESP_LOGI("LOADGEN", "  %-9s %u", mix_names[i], (unsigned)cur.sent[i]);
+    report_latency("corrected", cur.corrected, total);
+    report_latency("service", cur.service, total);
+    ESP_LOGI("LOADGEN", "  max       corrected %uus, service %uus", (unsigned)corrected_max, (unsigned)service_max);
+    asyncsmp_reclaim();
+    report_heap(&heap_baseline);
+#if CONFIG_IDF_TARGET_LINUX
+    exit(0);
+#endif
+}
@@ -0,0 +1,94 @@
+/**
+ * Copyright 2021 Michele Riva
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#include <asyncsmp_shm.h>
+#include <esp_log.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Build for the Linux target: idf.py --preview set-target linux
+
+// Endpoints and message types
+#define SERVER_ENDPOINT 0
+#define CLIENT_ENDPOINT 1
+typedef enum
+{
+    SERVER_SQUARE,
+    CLIENT_SQUARE_DONE
+} msg_t;
+
+// Server process, squaring numbers on request
+void server(void)
+{
+    // Attach to the transport created by the client
+    asyncsmp_shm_t *shm = asyncsmp_shm_attach("/asyncsmp-example");
+    asyncsmp_shm_msg_t msg;
+    while (asyncsmp_shm_receive(shm, SERVER_ENDPOINT, &msg, 1000))
+    {
+        switch (msg.type)
+        {
+        case SERVER_SQUARE:
+        {
+            // Square the number carried by the request, then respond
+            int *value = (int *)msg.req->data;
+            *value *= *value;
+            asyncsmp_shm_cb(shm, msg.req, 0);
+            break;
+        }
+        default:
+            ESP_LOGE("SERVER", "Unknown message type");
+        }
+    }
+
+    // No requests for a while, quit
+    asyncsmp_shm_detach(shm);
+    _exit(0);
+}
+
+// Main program execution (client process)
+void app_main(void)
+{
+    // Create the transport, with two endpoints and 16 request slots carrying an int
+    asyncsmp_shm_unlink("/asyncsmp-example");
+    asyncsmp_shm_t *shm = asyncsmp_shm_create("/asyncsmp-example", 2, 16, sizeof(int));
+
+    // Start the server process
+    pid_t pid = fork();
+    if (!pid)
+        server();
+
+    // Send requests
+    for (int i = 1; i <= 4; i++)
+    {
+        asyncsmp_shm_req_t *req = asyncsmp_shm_req_alloc(shm, CLIENT_ENDPOINT, CLIENT_SQUARE_DONE, sizeof(int));
+        *(int *)req->data = i;
+        ESP_LOGI("CLIENT", "Sending %d", i);
+        asyncsmp_shm_send(shm, SERVER_ENDPOINT, SERVER_SQUARE, req);
+    }
+
+    // Receive responses, as with queue message requests
+    asyncsmp_shm_msg_t msg;
+    for (int i = 0; i < 4; i++)
+    {
+        asyncsmp_shm_receive(shm, CLIENT_ENDPOINT, &msg, ASYNCSMP_SHM_FOREVER);
+        ESP_LOGI("CLIENT", "Received response %d (result: %d)", *(int *)msg.req->data, msg.req->ret);
+        asyncsmp_shm_req_free(shm, msg.req);
+    }
+
+    // Done, free resources
+    waitpid(pid, NULL, 0);
+    asyncsmp_shm_detach(shm);
+    asyncsmp_shm_unlink("/asyncsmp-example");
+}
@@ -17,6 +17,7 @@
 #pragma once
 
 #include <stddef.h>
+#include <sdkconfig.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include <freertos/semphr.h>
@@ -29,6 +30,70 @@ extern "C" {
 
 typedef struct asyncsmp_req asyncsmp_req_t;
 
+/**
+ * @brief Memory kinds
+ * 
+ * Allocators are told which part of a request they are allocating,
+ * so that each can be placed in the most suitable memory region.
+ */
+typedef enum asyncsmp_mem {
+    /** @brief Request structure (hot, small) */
+    ASYNCSMP_MEM_REQ,
+    /** @brief Callback arguments and other internal bookkeeping (hot, small) */
+    ASYNCSMP_MEM_CB_ARGS,
+    /** @brief Request data and stream rings (possibly large) */
+    ASYNCSMP_MEM_DATA,
+} asyncsmp_mem_t;
+
+/**
+ * @brief Allocator
+ * 
+ * Allocation hooks used for requests and their data.
+ */
+typedef struct asyncsmp_allocator {
+    /**
+     * @brief Allocation function
+     * 
+     * Must return zero-initialized memory, or NULL if allocation failed.
+     */
+    void *(*alloc)(asyncsmp_mem_t mem, size_t size, void *ctx);
+    /**
+     * @brief Deallocation function
+     * 
+     * Can be NULL for arena allocators, whose memory is released all at once.
+     * Requests allocated with such allocators are not tracked by the registry.
+     */
+    void (*free)(asyncsmp_mem_t mem, void *ptr, void *ctx);
+    /**
+     * @brief Context passed to the hooks
+     */
+    void *ctx;
+} asyncsmp_allocator_t;
+
+/**
+ * @brief Default allocator, based on calloc() and free()
+ */
+extern const asyncsmp_allocator_t asyncsmp_allocator_default;
+
+/**
+ * @brief PSRAM allocator
+ * 
+ * Places requests and callback arguments in internal memory and request data in PSRAM,
+ * falling back to any memory available if PSRAM is missing or full. Same as the default
+ * allocator if PSRAM support is disabled (CONFIG_SPIRAM), as on the Linux target.
+ */
+extern const asyncsmp_allocator_t asyncsmp_allocator_psram;
+
+/**
+ * @brief Set the global allocator.
+ * 
+ * The global allocator is used by all allocation functions, unless overridden
+ * on the call by the _ex variants. Requests are always freed with the allocator which allocated them.
+ * 
+ * @param[in] allocator Allocator (must outlive all requests allocated with it), or NULL to restore the default one
+ */
+void asyncsmp_set_allocator(const asyncsmp_allocator_t *allocator);
+
 /**
  * @brief Callback signature
  * 
@@ -52,6 +117,27 @@ typedef struct asyncsmp_req {
      * negative if an error occurred. 
      */
     int8_t ret;
+    /**
+     * @brief Core which last touched the request
+     * 
+     * Updated on allocation, on callback and when an asyncsmp_exec task starts processing the request.
+     * It is used as a locality hint by ASYNCSMP_AFFINITY_FOLLOW.
+     */
+    int8_t core;
+    /**
+     * @brief Request state flags
+     * 
+     * Updated atomically by callbacks and awaiters (for example to mark the request as completed).
+     * You don't normally need to alter this value.
+     */
+    volatile uint8_t state;
+    /**
+     * @brief Priority of the requesting task
+     * 
+     * Recorded on allocation if CONFIG_ASYNCSMP_PRIO_INHERIT is enabled. Receivers servicing
+     * the request inherit the highest priority along its parent chain via asyncsmp_prio_boost().
+     */
+    uint8_t prio;
     /**
      * @brief Callback function
      * 
@@ -80,6 +166,50 @@ typedef struct asyncsmp_req {
      * track of their relationship. Refer to the documentation for more details.
      */
     asyncsmp_req_t *parent;
+    /**
+     * @brief Heterogeneous awaiter
+     * 
+     * Set while the request is awaited via asyncsmp_await_any() or asyncsmp_await_all().
+     * You don't normally need to alter this value.
+     */
+    SemaphoreHandle_t waiter;
+    /**
+     * @brief Armed timer
+     * 
+     * Set while a timer from the asyncsmp timer service is armed on the request.
+     * You don't normally need to alter this value.
+     */
+    void *timer;
+    /**
+     * @brief Broadcast link
+     * 
+     * Links the request to the other subscribers while subscribed to a broadcast,
+     * then holds the broadcast payload once called back (see asyncsmp_bcast_payload()).
+     * You don't normally need to alter this value.
+     */
+    void *bcast;
+    /**
+     * @brief Allocator
+     * 
+     * The allocator which allocated the request, used again to free it.
+     * You don't normally need to alter this value.
+     */
+    const asyncsmp_allocator_t *allocator;
+#if CONFIG_ASYNCSMP_REGISTRY
+    /**
+     * @brief Registry bookkeeping
+     * 
+     * Present when CONFIG_ASYNCSMP_REGISTRY is enabled.
+     * You don't normally need to alter these values.
+     */
+    struct {
+        asyncsmp_req_t *next;
+        asyncsmp_req_t *prev;
+        TaskHandle_t owner;
+        TickType_t created;
+        uint8_t list;
+    } registry;
+#endif
 } asyncsmp_req_t;
 
 /**
@@ -125,12 +255,171 @@ typedef void(*asyncsmp_fn_t)(asyncsmp_req_t*);
  * This will execute fn in a new task which will be deleted once returned.
  * 
  * @param[in] fn Asynchronous function to execute
- * @param[in] stacksize Stack size of the task created to execute the function
- * @param[in] priority Priority of the task created to execute the function
+ * @param[in] stacksize Stack size of the task created to execute the function, or ASYNCSMP_STACK_AUTO
+ * @param[in] priority Priority of the task created to execute the function (raised to the request effective priority if higher and CONFIG_ASYNCSMP_PRIO_INHERIT is enabled, see asyncsmp_prio_boost())
  * @param[in] req Request to be processed by the function fn
  */
 bool asyncsmp_exec(asyncsmp_fn_t fn, asyncsmp_req_t *req, uint32_t stacksize, uint32_t priority);
 
+/**
+ * @brief Core affinity policy
+ * 
+ * Zero or positive values pin the task to the core with the same index,
+ * negative values select one of the ASYNCSMP_AFFINITY_* policies.
+ */
+typedef int32_t asyncsmp_affinity_t;
+
+/** @brief Run on any core available */
+#define ASYNCSMP_AFFINITY_ANY ((asyncsmp_affinity_t)-1)
+/** @brief Run on the same core as the caller */
+#define ASYNCSMP_AFFINITY_SAME ((asyncsmp_affinity_t)-2)
+/** @brief Run on a core other than the caller's (same core on single core targets) */
+#define ASYNCSMP_AFFINITY_OTHER ((asyncsmp_affinity_t)-3)
+/** @brief Run on the core which last touched the parent request (or the request itself if it has no parent) */
+#define ASYNCSMP_AFFINITY_FOLLOW ((asyncsmp_affinity_t)-4)
+
+/**
+ * @brief Execute asynchronous function in new task with a core affinity policy.
+ * 
+ * Same as asyncsmp_exec, but allows to choose on which core the function runs.
+ * Keeping a function on the core where its data was last used reduces cross-core cache traffic.
+ * 
+ * @param[in] fn Asynchronous function to execute
+ * @param[in] req Request to be processed by the function fn
+ * @param[in] stacksize Stack size of the task created to execute the function, or ASYNCSMP_STACK_AUTO
+ * @param[in] priority Priority of the task created to execute the function
+ * @param[in] affinity Core index or ASYNCSMP_AFFINITY_* policy
+ * @return true if the task was created, false otherwise (or if the core index is invalid)
+ */
+bool asyncsmp_exec_affinity(asyncsmp_fn_t fn, asyncsmp_req_t *req, uint32_t stacksize, uint32_t priority, asyncsmp_affinity_t affinity);
+
+/**
+ * @brief Automatic stack size
+ * 
+ * When passed as stack size to asyncsmp_exec, the stack is sized after the peak usage
+ * profiled for the function plus CONFIG_ASYNCSMP_STACK_AUTO_MARGIN, or CONFIG_ASYNCSMP_STACK_AUTO_DEFAULT
+ * if the function was not profiled yet (or profiling is disabled).
+ */
+#define ASYNCSMP_STACK_AUTO 0
+
+/**
+ * @brief Stack profile of an asynchronous function
+ * 
+ * Stack profiles are recorded when CONFIG_ASYNCSMP_STACK_PROFILE is enabled.
+ */
+typedef struct asyncsmp_stack_profile {
+    /**
+     * @brief Asynchronous function
+     */
+    asyncsmp_fn_t fn;
+    /**
+     * @brief Stack size of the last execution
+     */
+    uint32_t stacksize;
+    /**
+     * @brief Peak stack usage over all executions
+     */
+    uint32_t peak;
+    /**
+     * @brief Number of executions
+     */
+    uint32_t runs;
+} asyncsmp_stack_profile_t;
+
+/**
+ * @brief Report asynchronous functions with badly sized stacks.
+ * 
+ * Lists the profiled functions whose last stack size is either smaller than their peak usage
+ * plus margin (under-provisioned), or more than twice as much (over-provisioned).
+ * 
+ * @param[out] profiles Array to fill with the profiles of such functions
+ * @param[in] len Length of the array
+ * @param[in] margin Margin to add to peak usage
+ * @return Number of profiles written (always zero if profiling is disabled)
+ */
+size_t asyncsmp_stack_report(asyncsmp_stack_profile_t *profiles, size_t len, uint32_t margin);
+
+/**
+ * @brief Priority inheritance statistics
+ */
+typedef struct asyncsmp_prio_stats {
+    /**
+     * @brief Number of requests serviced via asyncsmp_prio_boost() or asyncsmp_exec()
+     */
+    uint32_t services;
+    /**
+     * @brief Number of services which required a priority boost
+     */
+    uint32_t boosts;
+} asyncsmp_prio_stats_t;
+
+/**
+ * @brief Effective priority of a request.
+ * @param[in] req Request
+ * @return Highest priority recorded along the request parent chain
+ */
+UBaseType_t asyncsmp_prio_get(asyncsmp_req_t *req);
+
+/**
+ * @brief Boost the calling task to the effective priority of a request, if higher.
+ * 
+ * To be called by receivers before servicing a request, so that a high priority requester
+ * does not wait on a low priority receiver. Asynchronous functions started by asyncsmp_exec()
+ * are boosted on creation. Does nothing if CONFIG_ASYNCSMP_PRIO_INHERIT is disabled.
+ * 
+ * @param[in] req Request to service
+ * @return Priority to restore via asyncsmp_prio_restore() once the request is called back
+ */
+UBaseType_t asyncsmp_prio_boost(asyncsmp_req_t *req);
+
+/**
+ * @brief Restore the calling task priority after a boost.
+ * @param[in] prio Priority returned by asyncsmp_prio_boost()
+ */
+void asyncsmp_prio_restore(UBaseType_t prio);
+
+/**
+ * @brief Get priority inheritance statistics.
+ * @param[out] stats Statistics
+ */
+void asyncsmp_prio_stats(asyncsmp_prio_stats_t *stats);
+
+/**
+ * @brief Deferred reclamation statistics
+ *
+ * Requests are retired instead of freed right away when CONFIG_ASYNCSMP_DEFERRED_FREE is enabled.
+ */
+typedef struct asyncsmp_reclaim_stats {
+    /**
+     * @brief Number of requests retired
+     */
+    uint32_t retired;
+    /**
+     * @brief Number of retired requests freed (retired - reclaimed are pending)
+     */
+    uint32_t reclaimed;
+    /**
+     * @brief Number of batches freed
+     */
+    uint32_t batches;
+} asyncsmp_reclaim_stats_t;
+
+/**
+ * @brief Free all retired requests right away.
+ *
+ * The reclaimer task does this in the background. It can also be called from an idle hook,
+ * or before releasing an allocator the retired requests came from.
+ *
+ * @return Number of requests freed (always zero if deferred reclamation is disabled)
+ */
+size_t asyncsmp_reclaim(void);
+
+/**
+ * @brief Get deferred reclamation statistics.
+ * @param[out] stats Statistics
+ */
+void asyncsmp_reclaim_stats(asyncsmp_reclaim_stats_t *stats);
+
 /**
  * @brief Callback a request with a return code.
  * 
@@ -142,6 +431,19 @@ bool asyncsmp_exec(asyncsmp_fn_t fn, asyncsmp_req_t *req, uint32_t stacksize, ui
  */
 void asyncsmp_cb(asyncsmp_req_t *req, int8_t ret);
 
+/**
+ * @brief Prepare a completed request to be sent again.
+ * 
+ * Completions are recorded in the request for asyncsmp_await_any() and asyncsmp_await_all(), and consumed
+ * by them and by asyncsmp_await_sem(). Awaiting a request via asyncsmp_await_tn(), asyncsmp_await_eg_all(),
+ * asyncsmp_await_eg_any() or by receiving its queue message leaves the completion recorded, so a reused
+ * request must be reset before being sent again by hand. Requests handed to asyncsmp_exec() and the other
+ * sending functions of this component are reset automatically.
+ * 
+ * @param[in] req Request to reset
+ */
+void asyncsmp_req_reset(asyncsmp_req_t *req);
+
 /**
  * @brief Allocate a custom request.
  * 
@@ -152,6 +454,17 @@ void asyncsmp_cb(asyncsmp_req_t *req, int8_t ret);
  */
 asyncsmp_req_t *asyncsmp_req_alloc_custom(asyncsmp_cb_t cb, void *cb_args, size_t data_size);
 
+/**
+ * @brief Allocate a custom request with a specific allocator.
+ * 
+ * @param[in] allocator Allocator overriding the global one (or NULL)
+ * @param[in] cb Callback function
+ * @param[in] cb_args Callback arguments
+ * @param[in] data_size Size of data to be carried
+ * @return Request, or NULL if allocation failed
+ */
+asyncsmp_req_t *asyncsmp_req_alloc_custom_ex(const asyncsmp_allocator_t *allocator, asyncsmp_cb_t cb, void *cb_args, size_t data_size);
+
 /**
  * @brief Free previously allocated custom request.
  * @warning This will also free the data pointer in the request structure
@@ -170,6 +483,18 @@ void asyncsmp_req_free_custom(asyncsmp_req_t *req);
  */
 asyncsmp_req_t *asyncsmp_req_alloc_qmsg(QueueHandle_t queue, asyncsmp_enum_t msg_type, SemaphoreHandle_t queue_guard, size_t data_size);
 
+/**
+ * @brief Allocate a queue message request with a specific allocator.
+ * 
+ * @param[in] allocator Allocator overriding the global one (or NULL)
+ * @param[in] queue Message queue
+ * @param[in] msg_type Message type
+ * @param[in] queue_guard Semaphore guard for message queue (optional, can be NULL)
+ * @param[in] data_size Size of data to be carried
+ * @return Request, or NULL if allocation failed
+ */
+asyncsmp_req_t *asyncsmp_req_alloc_qmsg_ex(const asyncsmp_allocator_t *allocator, QueueHandle_t queue, asyncsmp_enum_t msg_type, SemaphoreHandle_t queue_guard, size_t data_size);
+
 /**
  * @brief Free previously allocated queue message request.
  * @warning This will also free the data field in the request structure
@@ -184,14 +509,40 @@ void asyncsmp_req_free_qmsg(asyncsmp_req_t *req);
  */
 asyncsmp_req_t *asyncsmp_req_alloc_sem(size_t data_size);
 
+/**
+ * @brief Allocate a semaphore request with a specific allocator.
+ * @param[in] allocator Allocator overriding the global one (or NULL)
+ * @param[in] data_size Size of data to be carried
+ * @return Request, or NULL if allocation failed
+ */
+asyncsmp_req_t *asyncsmp_req_alloc_sem_ex(const asyncsmp_allocator_t *allocator, size_t data_size);
+
 /**
  * @brief Await a semaphore request.
+ * 
+ * Returns immediately if the request already completed. Otherwise a semaphore is taken
+ * from an internal pool (or created) for the time the awaiter is blocked.
+ * 
  * @param[in] req Request to await for
  * @param[in] ticks Ticks to wait before giving up
  * @return true if request returned within timeout, false otherwise
  */
 bool asyncsmp_await_sem(asyncsmp_req_t *req, TickType_t ticks);
 
+/**
+ * @brief Await a semaphore request, spinning briefly before blocking.
+ * 
+ * Requests serviced on another core often complete faster than a block/unblock round trip.
+ * This awaiter first polls the request completion flag for an adaptive budget, tuned on
+ * the completion times observed by previous adaptive awaits (whether they spun or blocked),
+ * and blocks only if that fails. Spinning stops paying off once completions take longer than blocking.
+ * 
+ * @param[in] req Request to await for
+ * @param[in] ticks Ticks to wait before giving up
+ * @return true if request returned within timeout, false otherwise
+ */
+bool asyncsmp_await_sem_adaptive(asyncsmp_req_t *req, TickType_t ticks);
+
 /**
  * @brief Free previously allocated semaphore request.
  * @warning This will also free the data field in the request structure
@@ -206,6 +557,14 @@ void asyncsmp_req_free_sem(asyncsmp_req_t *req);
  */
 asyncsmp_req_t *asyncsmp_req_alloc_tn(size_t data_size);
 
+/**
+ * @brief Allocate a task notification request with a specific allocator.
+ * @param[in] allocator Allocator overriding the global one (or NULL)
+ * @param[in] data_size Size of data to be carried
+ * @return Request, or NULL if allocation failed
+ */
+asyncsmp_req_t *asyncsmp_req_alloc_tn_ex(const asyncsmp_allocator_t *allocator, size_t data_size);
+
 /**
  * @brief Await a semaphore request.
  * @param[in] ticks Ticks to wait before giving up
@@ -213,6 +572,17 @@ asyncsmp_req_t *asyncsmp_req_alloc_tn(size_t data_size);
  */
 bool asyncsmp_await_tn(TickType_t ticks);
 
+/**
+ * @brief Await a task notification request, spinning briefly before blocking.
+ * 
+ * Same as asyncsmp_await_sem_adaptive, for task notification requests.
+ * 
+ * @param[in] req Request to await for
+ * @param[in] ticks Ticks to wait before giving up
+ * @return true if request returned within timeout, false otherwise
+ */
+bool asyncsmp_await_tn_adaptive(asyncsmp_req_t *req, TickType_t ticks);
+
 /**
  * @brief Free previously allocated task notification request.
  * @warning This will also free the data field in the request structure
@@ -229,6 +599,16 @@ void asyncsmp_req_free_tn(asyncsmp_req_t *req);
  */
 asyncsmp_req_t *asyncsmp_req_alloc_eg(EventGroupHandle_t eg, EventBits_t eb, size_t data_size);
 
+/**
+ * @brief Allocate an event group request with a specific allocator.
+ * @param[in] allocator Allocator overriding the global one (or NULL)
+ * @param[in] eg Event group handle
+ * @param[in] eb Event bit (or bitmask) assigned to the request
+ * @param[in] data_size Size of data to be carried
+ * @return Request, or NULL if allocation failed
+ */
+asyncsmp_req_t *asyncsmp_req_alloc_eg_ex(const asyncsmp_allocator_t *allocator, EventGroupHandle_t eg, EventBits_t eb, size_t data_size);
+
 /**
  * @brief Await all of the event group requests in the specified bitmask
  * @param[in] eg Event group handle
@@ -254,6 +634,94 @@ bool asyncsmp_await_eg_any(EventGroupHandle_t eg, EventBits_t eb, TickType_t tic
 */
 void asyncsmp_req_free_eg(asyncsmp_req_t *req);
 
+/**
+ * @brief Allocate a stream request.
+ * 
+ * Stream requests carry a bounded ring through which the receiver sends partial results
+ * while the requester reads them. The receiver blocks when the ring is full, and ends the stream
+ * by calling the request back. Stream requests cannot be awaited via asyncsmp_await_any() or asyncsmp_await_all().
+ * 
+ * @param[in] ring_size Size of the ring, in bytes (rounded up to a power of two, at most 2^31)
+ * @param[in] data_size Size of data to be carried
+ * @return Request, or NULL if allocation failed
+ */
+asyncsmp_req_t *asyncsmp_req_alloc_stream(size_t ring_size, size_t data_size);
+
+/**
+ * @brief Allocate a stream request with a specific allocator.
+ * @param[in] allocator Allocator overriding the global one (or NULL)
+ * @param[in] ring_size Size of the ring, in bytes (rounded up to a power of two, at most 2^31)
+ * @param[in] data_size Size of data to be carried
+ * @return Request, or NULL if allocation failed
+ */
+asyncsmp_req_t *asyncsmp_req_alloc_stream_ex(const asyncsmp_allocator_t *allocator, size_t ring_size, size_t data_size);
+
+/**
+ * @brief Write into a stream request (receiver side).
+ * @param[in] req Request
+ * @param[in] buf Data to write
+ * @param[in] len Length of data to write
+ * @param[in] ticks Ticks to wait for room in the ring before giving up
+ * @return Number of bytes written, less than len if timed out
+ */
+size_t asyncsmp_stream_write(asyncsmp_req_t *req, const void *buf, size_t len, TickType_t ticks);
+
+/**
+ * @brief Read from a stream request (requester side).
+ * 
+ * Returns as soon as some data is available.
+ * 
+ * @param[in] req Request
+ * @param[out] buf Buffer to read into
+ * @param[in] len Size of the buffer
+ * @param[in] ticks Ticks to wait for data before giving up
+ * @return Number of bytes read, 0 if timed out or if the stream ended (see asyncsmp_stream_ended())
+ */
+size_t asyncsmp_stream_read(asyncsmp_req_t *req, void *buf, size_t len, TickType_t ticks);
+
+/**
+ * @brief Check whether a stream request ended.
+ * @param[in] req Request
+ * @return true if the request was called back and all data was read, false otherwise
+ */
+bool asyncsmp_stream_ended(asyncsmp_req_t *req);
+
+/**
+ * @brief Free previously allocated stream request.
+ * @warning This will also free the data field in the request structure
+ * @param[out] req Request
+*/
+void asyncsmp_req_free_stream(asyncsmp_req_t *req);
+
+/**
+ * @brief Await any of the specified requests.
+ * 
+ * Semaphore, task notification, event group and queue message requests can be mixed together.
+ * The completion of the returned request is consumed, the others are left untouched and can be awaited again.
+ * For queue message requests only the completion is reported, the response message must still be received from the queue.
+ * Reused requests must be reset via asyncsmp_req_reset() before being sent again, unless their previous completion was
+ * consumed by asyncsmp_await_sem() or by this function.
+ * 
+ * @param[in] reqs Requests to await for
+ * @param[in] n Number of requests
+ * @param[in] ticks Ticks to wait before giving up
+ * @return Index of the completed request, or -1 if none returned within timeout
+ */
+int asyncsmp_await_any(asyncsmp_req_t **reqs, size_t n, TickType_t ticks);
+
+/**
+ * @brief Await all of the specified requests.
+ * 
+ * Same as asyncsmp_await_any(), but waits for all of the requests to complete.
+ * If the timeout expires no completion is consumed.
+ * 
+ * @param[in] reqs Requests to await for
+ * @param[in] n Number of requests
+ * @param[in] ticks Ticks to wait before giving up
+ * @return true if all requests returned within timeout, false otherwise
+ */
+bool asyncsmp_await_all(asyncsmp_req_t **reqs, size_t n, TickType_t ticks);
+
 /**
  * @brief Allocate request without callback.
  * @param[in] data_size Size of data to be carried
@@ -261,6 +729,44 @@ void asyncsmp_req_free_eg(asyncsmp_req_t *req);
  */
 asyncsmp_req_t *asyncsmp_req_alloc_noawait(size_t data_size);
 
+/**
+ * @brief Allocate request without callback with a specific allocator.
+ * @param[in] allocator Allocator overriding the global one (or NULL)
+ * @param[in] data_size Size of data to be carried
+ * @return Request, or NULL if allocation failed
+ */
+asyncsmp_req_t *asyncsmp_req_alloc_noawait_ex(const asyncsmp_allocator_t *allocator, size_t data_size);
+
+/**
+ * @brief Adaptive await statistics
+ */
+typedef struct asyncsmp_spin_stats {
+    /**
+     * @brief Number of adaptive awaits performed
+     */
+    uint32_t awaits;
+    /**
+     * @brief Number of adaptive awaits which completed while spinning, without blocking
+     */
+    uint32_t spin_hits;
+    /**
+     * @brief Current spin budget (CPU cycles)
+     */
+    uint32_t budget;
+} asyncsmp_spin_stats_t;
+
+/**
+ * @brief Get adaptive await statistics of semaphore requests.
+ * @param[out] stats Statistics
+ */
+void asyncsmp_spin_stats_sem(asyncsmp_spin_stats_t *stats);
+
+/**
+ * @brief Get adaptive await statistics of task notification requests.
+ * @param[out] stats Statistics
+ */
+void asyncsmp_spin_stats_tn(asyncsmp_spin_stats_t *stats);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,315 @@
+/**
+ * Copyright 2021 Michele Riva
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#pragma once
+
+#if __cplusplus < 202002L
+#error "asyncsmp.hpp requires C++20"
+#endif
+
+#include <asyncsmp.h>
+#include <coroutine>
+#include <cstdlib>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace asyncsmp
+{
+
+namespace detail
+{
+
+template <typename T>
+inline constexpr size_t payload_size = sizeof(T);
+template <>
+inline constexpr size_t payload_size<void> = 0;
+
+inline char completed;
+
+} // namespace detail
+
+/**
+ * @brief Owning request handle
+ *
+ * Frees the request with the matching asyncsmp_req_free function when destroyed,
+ * and gives typed access to its payload. Payloads are shared with C receivers
+ * via req->data, so they must be trivially destructible.
+ *
+ * @tparam T Payload type (void for none)
+ * @tparam Free Free function matching the request type
+ */
+template <typename T, void (*Free)(asyncsmp_req_t *)>
+class request
+{
+    static_assert(std::is_void_v<T> || std::is_trivially_destructible_v<T>, "request payloads must be trivially destructible");
+
+public:
+    request() noexcept = default;
+    request(const request &) = delete;
+    request &operator=(const request &) = delete;
+    request(request &&other) noexcept : req_(std::exchange(other.req_, nullptr)) {}
+    request &operator=(request &&other) noexcept
+    {
+        if (this != &other)
+        {
+            reset();
+            req_ = std::exchange(other.req_, nullptr);
+        }
+        return *this;
+    }
+    ~request() { reset(); }
+
+    /**
+     * @brief Whether the allocation succeeded
+     */
+    explicit operator bool() const noexcept { return req_ != nullptr; }
+
+    /**
+     * @brief Underlying request, to be sent to receivers
+     */
+    asyncsmp_req_t *get() const noexcept { return req_; }
+
+    /**
+     * @brief Give up ownership of the underlying request
+     */
+    asyncsmp_req_t *release() noexcept { return std::exchange(req_, nullptr); }
+
+    /**
+     * @brief Free the underlying request
+     */
+    void reset() noexcept
+    {
+        if (req_)
+            Free(std::exchange(req_, nullptr));
+    }
+
+    /**
+     * @brief Return code
+     */
+    int8_t ret() const noexcept { return req_->ret; }
+
+    /**
+     * @brief Typed payload
+     */
+    template <typename U = T>
+        requires(!std::is_void_v<U>)
+    U *data() const noexcept { return static_cast<U *>(req_->data); }
+
+    template <typename U = T>
+        requires(!std::is_void_v<U>)
+    U *operator->() const noexcept { return data(); }
+
+protected:
+    explicit request(asyncsmp_req_t *req) noexcept : req_(req)
+    {
+        if constexpr (!std::is_void_v<T>)
+        {
+            if (req_)
+                new (req_->data) T();
+        }
+    }
+
+    asyncsmp_req_t *req_ = nullptr;
+};
+
+/**
+ * @brief Semaphore request
+ *
+ * Kernel-backed requests block the calling task when awaited, so they cannot be co_awaited:
+ * use co_request from coroutines.
+ */
+template <typename T = void>
+class sem_request : public request<T, asyncsmp_req_free_sem>
+{
+    using base = request<T, asyncsmp_req_free_sem>;
+    using base::base;
+
+public:
+    sem_request() noexcept = default;
+
+    static sem_request create() noexcept { return sem_request(asyncsmp_req_alloc_sem(detail::payload_size<T>)); }
+
+    bool await(TickType_t ticks = portMAX_DELAY) const noexcept { return asyncsmp_await_sem(this->req_, ticks); }
+
+    bool await_adaptive(TickType_t ticks = portMAX_DELAY) const noexcept { return asyncsmp_await_sem_adaptive(this->req_, ticks); }
+};
+
+/**
+ * @brief Task notification request
+ *
+ * Must be created by the task which awaits it. Awaiting takes the task notification,
+ * so only one task notification request can be in flight per task.
+ */
+template <typename T = void>
+class tn_request : public request<T, asyncsmp_req_free_tn>
+{
+    using base = request<T, asyncsmp_req_free_tn>;
+    using base::base;
+
+public:
+    tn_request() noexcept = default;
+
+    static tn_request create() noexcept { return tn_request(asyncsmp_req_alloc_tn(detail::payload_size<T>)); }
+
+    bool await(TickType_t ticks = portMAX_DELAY) const noexcept
+    {
+        if (!asyncsmp_await_tn(ticks))
+            return false;
+        asyncsmp_req_reset(this->req_);
+        return true;
+    }
+
+    bool await_adaptive(TickType_t ticks = portMAX_DELAY) const noexcept { return asyncsmp_await_tn_adaptive(this->req_, ticks); }
+};
+
+/**
+ * @brief Event group request
+ */
+template <typename T = void>
+class eg_request : public request<T, asyncsmp_req_free_eg>
+{
+    using base = request<T, asyncsmp_req_free_eg>;
+
+    eg_request(asyncsmp_req_t *req, EventGroupHandle_t eg, EventBits_t eb) noexcept : base(req), eg_(eg), eb_(eb) {}
+
+    EventGroupHandle_t eg_ = nullptr;
+    EventBits_t eb_ = 0;
+
+public:
+    eg_request() noexcept = default;
+
+    static eg_request create(EventGroupHandle_t eg, EventBits_t eb) noexcept { return eg_request(asyncsmp_req_alloc_eg(eg, eb, detail::payload_size<T>), eg, eb); }
+
+    bool await(TickType_t ticks = portMAX_DELAY) const noexcept
+    {
+        if (!asyncsmp_await_eg_all(eg_, eb_, ticks))
+            return false;
+        asyncsmp_req_reset(this->req_);
+        return true;
+    }
+};
+
+/**
+ * @brief Queue message request
+ *
+ * The response is received from the queue, so there is nothing to await.
+ */
+template <typename T = void>
+class qmsg_request : public request<T, asyncsmp_req_free_qmsg>
+{
+    using base = request<T, asyncsmp_req_free_qmsg>;
+    using base::base;
+
+public:
+    qmsg_request() noexcept = default;
+
+    static qmsg_request create(QueueHandle_t queue, asyncsmp_enum_t msg_type, SemaphoreHandle_t queue_guard = nullptr) noexcept
+    {
+        return qmsg_request(asyncsmp_req_alloc_qmsg(queue, msg_type, queue_guard, detail::payload_size<T>));
+    }
+
+    /**
+     * @brief Adopt a request received as a response message
+     */
+    static qmsg_request adopt(asyncsmp_req_t *req) noexcept
+    {
+        qmsg_request adopted;
+        adopted.req_ = req;
+        return adopted;
+    }
+};
+
+/**
+ * @brief Custom request with a callback fixed at compile time
+ *
+ * @tparam T Payload type (void for none)
+ * @tparam Cb Callback function
+ */
+template <typename T, asyncsmp_cb_t Cb>
+class custom_request : public request<T, asyncsmp_req_free_custom>
+{
+    using base = request<T, asyncsmp_req_free_custom>;
+    using base::base;
+
+public:
+    custom_request() noexcept = default;
+
+    static custom_request create(void *cb_args = nullptr) noexcept { return custom_request(asyncsmp_req_alloc_custom(Cb, cb_args, detail::payload_size<T>)); }
+};
+
+/**
+ * @brief Coroutine request
+ *
+ * Awaiting suspends the coroutine, which is then resumed by the task calling the request back.
+ * The coroutine handle is stored in the request itself, so awaiting does not allocate.
+ */
+template <typename T = void>
+class co_request : public request<T, asyncsmp_req_free_custom>
+{
+    using base = request<T, asyncsmp_req_free_custom>;
+    using base::base;
+
+    static void resume(asyncsmp_req_t *req) noexcept
+    {
+        void *waiter = __atomic_exchange_n(&req->cb_args, static_cast<void *>(&detail::completed), __ATOMIC_ACQ_REL);
+        if (waiter)
+            std::coroutine_handle<>::from_address(waiter).resume();
+    }
+
+    struct awaiter
+    {
+        asyncsmp_req_t *req;
+        bool await_ready() const noexcept { return __atomic_load_n(&req->cb_args, __ATOMIC_ACQUIRE) == &detail::completed; }
+        bool await_suspend(std::coroutine_handle<> handle) const noexcept
+        {
+            // Do not suspend if the request completed in the meantime
+            void *expected = nullptr;
+            return __atomic_compare_exchange_n(&req->cb_args, &expected, handle.address(), false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+        }
+        int8_t await_resume() const noexcept
+        {
+            __atomic_store_n(&req->cb_args, nullptr, __ATOMIC_RELAXED);
+            return req->ret;
+        }
+    };
+
+public:
+    co_request() noexcept = default;
+
+    static co_request create() noexcept { return co_request(asyncsmp_req_alloc_custom(resume, nullptr, detail::payload_size<T>)); }
+
+    awaiter operator co_await() const noexcept { return awaiter{this->req_}; }
+};
+
+/**
+ * @brief Fire-and-forget coroutine
+ *
+ * Starts running immediately and releases its frame when it returns.
+ */
+struct detached
+{
+    struct promise_type
+    {
+        detached get_return_object() noexcept { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { std::abort(); }
+    };
+};
+
+} // namespace asyncsmp
@@ -0,0 +1,114 @@
+/**
+ * Copyright 2021 Michele Riva
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#pragma once
+
+#include <asyncsmp.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Broadcast
+ *
+ * Subscribers register requests of any type on a broadcast, and a single call back
+ * completes all of them with the same return code and a shared, reference counted payload.
+ * Subscription is one-shot: a request is called back by the next broadcast only.
+ */
+typedef struct asyncsmp_bcast asyncsmp_bcast_t;
+
+/**
+ * @brief Create a broadcast.
+ * @return Broadcast, or NULL if allocation failed
+ */
+asyncsmp_bcast_t *asyncsmp_bcast_create(void);
+
+/**
+ * @brief Delete a broadcast.
+ * @warning There must be no subscribed requests
+ * @param[in] bcast Broadcast
+ */
+void asyncsmp_bcast_delete(asyncsmp_bcast_t *bcast);
+
+/**
+ * @brief Subscribe a request to the next broadcast.
+ *
+ * Subscribing does not allocate: while subscribed, the request is linked to the other subscribers through
+ * its own bcast field, which holds the broadcast payload once called back (see asyncsmp_bcast_payload()).
+ * The request data is left untouched. No-await requests can subscribe too, but do not get a payload
+ * reference as they are freed right away.
+ *
+ * @param[in] bcast Broadcast
+ * @param[in] req Request
+ */
+void asyncsmp_bcast_subscribe(asyncsmp_bcast_t *bcast, asyncsmp_req_t *req);
+
+/**
+ * @brief Unsubscribe a request before it is called back.
+ * @param[in] bcast Broadcast
+ * @param[in] req Request
+ * @return true if the request was unsubscribed, false if it was not subscribed (or already called back)
+ */
+bool asyncsmp_bcast_unsubscribe(asyncsmp_bcast_t *bcast, asyncsmp_req_t *req);
+
+/**
+ * @brief Callback all subscribed requests.
+ *
+ * Each subscriber gets its own reference to the payload, except no-await requests which get none.
+ * The caller reference is released once all subscribers have been called back. Subscribers which
+ * never block are called back with the scheduler of the calling core suspended, so that those woken up
+ * on this core do not preempt the caller one at a time. Subscribers on other cores are not batched.
+ *
+ * @param[in] bcast Broadcast
+ * @param[in] payload Payload allocated with asyncsmp_bcast_payload_alloc() (or NULL)
+ * @param[in] ret Return code of the operation
+ * @return Number of requests called back
+ */
+size_t asyncsmp_bcast_cb(asyncsmp_bcast_t *bcast, void *payload, int8_t ret);
+
+/**
+ * @brief Allocate a reference counted payload, holding one reference.
+ * @param[in] size Size of the payload
+ * @return Zeroed payload, or NULL if allocation failed
+ */
+void *asyncsmp_bcast_payload_alloc(size_t size);
+
+/**
+ * @brief Get the payload of a request called back by a broadcast.
+ *
+ * The reference held by the request must be released via asyncsmp_bcast_payload_release().
+ *
+ * @param[in] req Request
+ * @return Payload (or NULL)
+ */
+void *asyncsmp_bcast_payload(asyncsmp_req_t *req);
+
+/**
+ * @brief Take an additional reference to a payload.
+ * @param[in] payload Payload (or NULL)
+ */
+void asyncsmp_bcast_payload_retain(void *payload);
+
+/**
+ * @brief Release a reference to a payload, freeing it with the last one.
+ * @param[in] payload Payload (or NULL)
+ */
+void asyncsmp_bcast_payload_release(void *payload);
+
+#ifdef __cplusplus
+}
+#endif
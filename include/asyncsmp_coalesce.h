@@ -0,0 +1,83 @@
+/**
+ * Copyright 2021 Michele Riva
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#pragma once
+
+#include <asyncsmp.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Coalescer
+ * 
+ * Receivers use a coalescer to serve identical in-flight requests only once.
+ * Requests are identified by their message type and a user key.
+ */
+typedef struct asyncsmp_coalesce asyncsmp_coalesce_t;
+
+/**
+ * @brief Create a coalescer.
+ * 
+ * Up to 64 results are cached at a time, results beyond that are not cached until older ones expire.
+ * Expired results are purged as new requests come in.
+ * 
+ * @param[in] data_size Size of the request data copied from the served request to the coalesced ones
+ * @param[in] ttl Ticks for which a result is cached and served to new identical requests (0 to disable)
+ * @return Coalescer, or NULL if allocation failed
+ */
+asyncsmp_coalesce_t *asyncsmp_coalesce_create(size_t data_size, TickType_t ttl);
+
+/**
+ * @brief Delete a coalescer.
+ * @warning There must be no requests in flight
+ * @param[in] coalesce Coalescer
+ */
+void asyncsmp_coalesce_delete(asyncsmp_coalesce_t *coalesce);
+
+/**
+ * @brief Join an incoming request.
+ * 
+ * If an identical request is already in flight, the request is attached to it and will be called back together.
+ * If a fresh cached result is available, the request is called back right away with it.
+ * Otherwise the request becomes the one in flight, and the receiver must serve it and call it back via asyncsmp_coalesce_cb().
+ * 
+ * @param[in] coalesce Coalescer
+ * @param[in] msg_type Message type
+ * @param[in] key User key
+ * @param[in] req Incoming request
+ * @return true if the receiver must serve the request, false if it was coalesced or served from cache
+ */
+bool asyncsmp_coalesce_join(asyncsmp_coalesce_t *coalesce, asyncsmp_enum_t msg_type, uint32_t key, asyncsmp_req_t *req);
+
+/**
+ * @brief Callback a served request and all requests coalesced with it.
+ * 
+ * The data of the served request is copied into the coalesced requests before they are called back,
+ * except for requests allocated without data.
+ * 
+ * @param[in] coalesce Coalescer
+ * @param[in] msg_type Message type
+ * @param[in] key User key
+ * @param[in] req Served request
+ * @param[in] ret Return code of the operation
+ */
+void asyncsmp_coalesce_cb(asyncsmp_coalesce_t *coalesce, asyncsmp_enum_t msg_type, uint32_t key, asyncsmp_req_t *req, int8_t ret);
+
+#ifdef __cplusplus
+}
+#endif
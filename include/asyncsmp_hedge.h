@@ -0,0 +1,128 @@
+/**
+ * Copyright 2021 Michele Riva
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#pragma once
+
+#include <asyncsmp.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Hedger
+ *
+ * Requesters use a hedger to send requests to a set of equivalent receivers. If the receiver
+ * of a request does not answer within a percentile of the latencies observed so far,
+ * a duplicate is sent to another one, and the first answer wins.
+ */
+typedef struct asyncsmp_hedge asyncsmp_hedge_t;
+
+/**
+ * @brief Hedger statistics
+ */
+typedef struct asyncsmp_hedge_stats
+{
+    /**
+     * @brief Number of requests sent
+     */
+    uint32_t requests;
+    /**
+     * @brief Number of duplicates sent (hedge rate = hedged / requests)
+     */
+    uint32_t hedged;
+    /**
+     * @brief Number of requests answered by their duplicate first (win rate = wins / hedged)
+     */
+    uint32_t wins;
+    /**
+     * @brief Number of late answers discarded
+     */
+    uint32_t discarded;
+    /**
+     * @brief Current hedging delay in ticks, or portMAX_DELAY while latencies are still being observed
+     */
+    TickType_t delay;
+} asyncsmp_hedge_stats_t;
+
+/**
+ * @brief Create a hedger.
+ *
+ * Duplicates are armed on the timer service, which must be started via asyncsmp_timer_init().
+ *
+ * @param[in] receivers Queues of the receiver tasks (copied)
+ * @param[in] n Number of receivers (at least two for requests to be hedged)
+ * @param[in] msg_type Message type of the requests
+ * @param[in] data_size Size of the request data copied to the receivers, and back from the winning one
+ * @param[in] percentile Latency percentile after which a duplicate is sent (for example 95)
+ * @param[in] min_delay Minimum ticks to wait before sending a duplicate
+ * @return Hedger, or NULL if allocation failed
+ */
+asyncsmp_hedge_t *asyncsmp_hedge_create(const QueueHandle_t *receivers, size_t n, asyncsmp_enum_t msg_type, size_t data_size, uint8_t percentile, TickType_t min_delay);
+
+/**
+ * @brief Delete a hedger.
+ * @warning There must be no requests in flight, including late answers still to be discarded
+ * @param[in] hedge Hedger
+ */
+void asyncsmp_hedge_delete(asyncsmp_hedge_t *hedge);
+
+/**
+ * @brief Send a request through a hedger.
+ *
+ * Receivers get a message of the hedger type carrying a copy of the request, which they serve
+ * and call back as usual. The request itself is called back with the return code and data
+ * of the first copy answered. Copies answered later are discarded and freed by the hedger.
+ *
+ * @param[in] hedge Hedger
+ * @param[in] req Request, of any type, with at least data_size bytes of data
+ * @return true if the request was sent, false if allocation failed or all receiver queues were full
+ */
+bool asyncsmp_hedge_send(asyncsmp_hedge_t *hedge, asyncsmp_req_t *req);
+
+/**
+ * @brief Check whether a copy of a hedged request lost (receiver side).
+ *
+ * Receivers can use this to skip serving a copy whose answer would be discarded.
+ * The copy must be called back anyway.
+ *
+ * @param[in] req Copy of a hedged request, as received
+ * @return true if another copy was answered first, false otherwise
+ */
+bool asyncsmp_hedge_cancelled(asyncsmp_req_t *req);
+
+/**
+ * @brief Get a percentile of the latencies observed by a hedger.
+ *
+ * Latencies are measured for every copy answered, losers included, and older samples
+ * are progressively forgotten so that the percentiles follow the receivers.
+ *
+ * @param[in] hedge Hedger
+ * @param[in] percentile Percentile (0-100)
+ * @return Latency in ticks, or portMAX_DELAY if no latency was observed yet
+ */
+TickType_t asyncsmp_hedge_latency(asyncsmp_hedge_t *hedge, uint8_t percentile);
+
+/**
+ * @brief Get hedger statistics.
+ * @param[in] hedge Hedger
+ * @param[out] stats Statistics
+ */
+void asyncsmp_hedge_stats(asyncsmp_hedge_t *hedge, asyncsmp_hedge_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,141 @@
+/**
+ * Copyright 2021 Michele Riva
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#pragma once
+
+#include <asyncsmp.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief I/O engine
+ *
+ * A dedicated worker task performing file and device I/O on behalf of other tasks.
+ * Operations queued together are served in batches, merging adjacent ones into fewer calls.
+ */
+typedef struct asyncsmp_io asyncsmp_io_t;
+
+/**
+ * @brief Offset value for streams (UARTs, sockets...), read and written at their current position
+ */
+#define ASYNCSMP_IO_STREAM ((off_t)-1)
+
+/**
+ * @brief I/O operation type
+ */
+typedef enum asyncsmp_io_type
+{
+    ASYNCSMP_IO_READ,
+    ASYNCSMP_IO_WRITE,
+    ASYNCSMP_IO_FLUSH,
+} asyncsmp_io_type_t;
+
+/**
+ * @brief I/O operation
+ *
+ * Carried as data by the requests submitted to an I/O engine.
+ */
+typedef struct asyncsmp_io_op
+{
+    /**
+     * @brief Operation type
+     */
+    asyncsmp_io_type_t type;
+    /**
+     * @brief File descriptor
+     */
+    int fd;
+    /**
+     * @brief Buffer to read into or write from (unused for flushes)
+     */
+    void *buf;
+    /**
+     * @brief Number of bytes to read or write (unused for flushes)
+     */
+    size_t len;
+    /**
+     * @brief File offset, or ASYNCSMP_IO_STREAM (unused for flushes)
+     */
+    off_t offset;
+    /**
+     * @brief Result, set before the request is called back
+     *
+     * Number of bytes read or written (0 for flushes), or -errno on failure.
+     * The request return code is 0 on success, -1 on failure.
+     */
+    ssize_t result;
+} asyncsmp_io_op_t;
+
+/**
+ * @brief I/O engine statistics
+ */
+typedef struct asyncsmp_io_stats
+{
+    /**
+     * @brief Number of operations performed
+     */
+    uint32_t ops;
+    /**
+     * @brief Number of batches served
+     */
+    uint32_t batches;
+    /**
+     * @brief Number of system calls issued, lower than ops when operations are merged
+     */
+    uint32_t calls;
+} asyncsmp_io_stats_t;
+
+/**
+ * @brief Create an I/O engine and its worker task.
+ * @param[in] queue_len Maximum number of queued operations
+ * @param[in] stacksize Stack size of the worker task, in bytes
+ * @param[in] priority Priority of the worker task (boosted to the priority of the requests it serves, see asyncsmp_prio_boost())
+ * @return I/O engine, or NULL if allocation failed
+ */
+asyncsmp_io_t *asyncsmp_io_create(size_t queue_len, uint32_t stacksize, UBaseType_t priority);
+
+/**
+ * @brief Delete an I/O engine, once queued operations are served.
+ * @param[in] io I/O engine
+ */
+void asyncsmp_io_delete(asyncsmp_io_t *io);
+
+/**
+ * @brief Submit a request to an I/O engine.
+ *
+ * The request must carry an asyncsmp_io_op_t as data. It is called back via asyncsmp_cb() once the operation is performed.
+ * Operations on the same file descriptor are performed in submission order.
+ *
+ * @param[in] io I/O engine
+ * @param[in] req Request
+ * @param[in] ticks Ticks to wait for room in the queue before giving up
+ * @return true if submitted, false otherwise
+ */
+bool asyncsmp_io_submit(asyncsmp_io_t *io, asyncsmp_req_t *req, TickType_t ticks);
+
+/**
+ * @brief Get I/O engine statistics.
+ * @param[in] io I/O engine
+ * @param[out] stats Statistics
+ */
+void asyncsmp_io_stats(asyncsmp_io_t *io, asyncsmp_io_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
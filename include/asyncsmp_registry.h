@@ -0,0 +1,86 @@
+/**
+ * Copyright 2021 Michele Riva
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#pragma once
+
+#include <asyncsmp.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Outstanding request information
+ */
+typedef struct asyncsmp_req_info {
+    /**
+     * @brief Request
+     */
+    asyncsmp_req_t *req;
+    /**
+     * @brief Request type ("sem", "tn", "qmsg", "eg", "stream", "noawait" or "custom")
+     */
+    const char *type;
+    /**
+     * @brief Task which allocated the request
+     */
+    TaskHandle_t owner;
+    /**
+     * @brief Ticks elapsed since allocation
+     */
+    TickType_t age;
+    /**
+     * @brief Parent request
+     */
+    asyncsmp_req_t *parent;
+} asyncsmp_req_info_t;
+
+/**
+ * @brief List outstanding requests.
+ * 
+ * Requests are tracked from allocation to release when CONFIG_ASYNCSMP_REGISTRY is enabled.
+ * 
+ * @param[out] infos Array to fill with request information
+ * @param[in] len Length of the array
+ * @param[in] min_age Minimum age of the listed requests
+ * @return Number of requests listed (always zero if the registry is disabled)
+ */
+size_t asyncsmp_registry_list(asyncsmp_req_info_t *infos, size_t len, TickType_t min_age);
+
+/**
+ * @brief Log outstanding requests, along with their parent chain.
+ * 
+ * @param[in] min_age Minimum age of the logged requests
+ */
+void asyncsmp_registry_dump(TickType_t min_age);
+
+/**
+ * @brief Start the stall detector.
+ * 
+ * The stall detector periodically looks for requests older than a threshold,
+ * and logs each of them once along with its parent chain.
+ * 
+ * @param[in] threshold Age after which a request is considered stalled
+ * @param[in] period Ticks between checks
+ * @param[in] stacksize Stack size of the stall detector task
+ * @param[in] priority Priority of the stall detector task (should be low)
+ * @return true if the stall detector is running, false otherwise (or if the registry is disabled)
+ */
+bool asyncsmp_registry_watchdog_start(TickType_t threshold, TickType_t period, uint32_t stacksize, uint32_t priority);
+
+#ifdef __cplusplus
+}
+#endif
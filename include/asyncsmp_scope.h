@@ -0,0 +1,84 @@
+/**
+ * Copyright 2021 Michele Riva
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#pragma once
+
+#include <asyncsmp.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Scope
+ *
+ * Requests allocated within a scope come from a bump allocator, and are all released at once
+ * when the scope is closed. Functions executed within a scope are joined before closing it.
+ */
+typedef struct asyncsmp_scope asyncsmp_scope_t;
+
+/**
+ * @brief Create a scope.
+ * @param[in] chunk_size Size of the memory chunks requests are allocated from
+ * @return Scope, or NULL if allocation failed
+ */
+asyncsmp_scope_t *asyncsmp_scope_create(size_t chunk_size);
+
+/**
+ * @brief Allocator of a scope.
+ *
+ * To be passed to the _ex allocation functions. Requests allocated with it can still be freed
+ * with the matching asyncsmp_req_free function, but their memory is only released when the scope is closed.
+ *
+ * @param[in] scope Scope
+ * @return Allocator
+ */
+const asyncsmp_allocator_t *asyncsmp_scope_allocator(asyncsmp_scope_t *scope);
+
+/**
+ * @brief Execute a function asynchronously within a scope.
+ *
+ * Same as asyncsmp_exec(), the scope is not closed until the function returns.
+ *
+ * @param[in] scope Scope
+ * @param[in] fn Function to execute
+ * @param[in] req Request passed to the function
+ * @param[in] stacksize Stack size of the executing task, in bytes (or ASYNCSMP_STACK_AUTO)
+ * @param[in] priority Priority of the executing task
+ * @return true if the function was started, false otherwise
+ */
+bool asyncsmp_scope_exec(asyncsmp_scope_t *scope, asyncsmp_fn_t fn, asyncsmp_req_t *req, uint32_t stacksize, uint32_t priority);
+
+/**
+ * @brief Wait for all functions executed within a scope to return.
+ * @param[in] scope Scope
+ * @param[in] ticks Ticks to wait before giving up
+ * @return true if all functions returned within timeout, false otherwise
+ */
+bool asyncsmp_scope_join(asyncsmp_scope_t *scope, TickType_t ticks);
+
+/**
+ * @brief Join a scope, then release it along with all requests allocated within it.
+ * @warning Requests allocated within the scope must not be in use anymore (for example, no timers armed)
+ * @param[in] scope Scope
+ * @param[in] ticks Ticks to wait for executed functions before giving up
+ * @return true if the scope was closed, false if functions were still running (the scope is left open)
+ */
+bool asyncsmp_scope_close(asyncsmp_scope_t *scope, TickType_t ticks);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,187 @@
+/**
+ * Copyright 2021 Michele Riva
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#pragma once
+
+#include <asyncsmp.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Shared memory transport (Linux target only)
+ *
+ * Processes exchange requests through a shared memory object holding a slab of request slots
+ * and one message ring per endpoint. Requests refer to each other by offset, as the object
+ * is mapped at a different address in each process.
+ */
+typedef struct asyncsmp_shm asyncsmp_shm_t;
+
+/**
+ * @brief Timeout value to wait forever
+ */
+#define ASYNCSMP_SHM_FOREVER UINT32_MAX
+
+/**
+ * @brief Shared memory request
+ *
+ * Lives in the shared memory slab, and is sent back to its reply endpoint when called back.
+ */
+typedef struct asyncsmp_shm_req
+{
+    /**
+     * @brief Return code of the operation
+     */
+    int8_t ret;
+    uint8_t reserved;
+    /**
+     * @brief Endpoint the response is sent to
+     */
+    uint16_t reply_to;
+    /**
+     * @brief Message type of the response
+     */
+    asyncsmp_enum_t reply_type;
+    /**
+     * @brief Offset of the parent request (0 if none)
+     */
+    uint32_t parent;
+    /**
+     * @brief Free list link (internal)
+     */
+    uint32_t next;
+    /**
+     * @brief Data carried by the request
+     */
+    uint8_t data[] __attribute__((aligned(8)));
+} asyncsmp_shm_req_t;
+
+/**
+ * @brief Shared memory message
+ */
+typedef struct asyncsmp_shm_msg
+{
+    /**
+     * @brief Message type
+     */
+    asyncsmp_enum_t type;
+    /**
+     * @brief Request, mapped in the receiving process
+     */
+    asyncsmp_shm_req_t *req;
+} asyncsmp_shm_msg_t;
+
+/**
+ * @brief Create and map a shared memory transport.
+ * @param[in] name Shared memory object name (as for shm_open, e.g. "/gateway")
+ * @param[in] endpoints Number of endpoints, each with its own message ring
+ * @param[in] slots Number of request slots
+ * @param[in] data_size Maximum size of the data carried by a request
+ * @return Transport, or NULL if the object could not be created (for example, if it already exists)
+ */
+asyncsmp_shm_t *asyncsmp_shm_create(const char *name, uint16_t endpoints, uint32_t slots, size_t data_size);
+
+/**
+ * @brief Map a shared memory transport created by another process.
+ * @param[in] name Shared memory object name
+ * @return Transport, or NULL if the object does not exist or is not initialized yet
+ */
+asyncsmp_shm_t *asyncsmp_shm_attach(const char *name);
+
+/**
+ * @brief Unmap a shared memory transport.
+ * @param[in] shm Transport
+ */
+void asyncsmp_shm_detach(asyncsmp_shm_t *shm);
+
+/**
+ * @brief Remove a shared memory object name, once all processes are done with it.
+ * @param[in] name Shared memory object name
+ */
+void asyncsmp_shm_unlink(const char *name);
+
+/**
+ * @brief Allocate a shared memory request.
+ * @param[in] shm Transport
+ * @param[in] reply_to Endpoint the response is sent to
+ * @param[in] reply_type Message type of the response
+ * @param[in] data_size Size of data to be carried
+ * @return Zeroed request, or NULL if no slot is free or data_size exceeds the slot size
+ */
+asyncsmp_shm_req_t *asyncsmp_shm_req_alloc(asyncsmp_shm_t *shm, uint16_t reply_to, asyncsmp_enum_t reply_type, size_t data_size);
+
+/**
+ * @brief Free a shared memory request.
+ * @param[in] shm Transport
+ * @param[in] req Request
+ */
+void asyncsmp_shm_req_free(asyncsmp_shm_t *shm, asyncsmp_shm_req_t *req);
+
+/**
+ * @brief Send a request to an endpoint.
+ *
+ * Never blocks: rings can hold every slot of the slab at once.
+ *
+ * @param[in] shm Transport
+ * @param[in] endpoint Receiving endpoint
+ * @param[in] msg_type Message type
+ * @param[in] req Request
+ * @return true if sent, false if the endpoint does not exist
+ */
+bool asyncsmp_shm_send(asyncsmp_shm_t *shm, uint16_t endpoint, asyncsmp_enum_t msg_type, asyncsmp_shm_req_t *req);
+
+/**
+ * @brief Receive a message from an endpoint.
+ * @warning Each endpoint must have a single receiver
+ * @param[in] shm Transport
+ * @param[in] endpoint Endpoint
+ * @param[out] msg Received message
+ * @param[in] timeout_ms Milliseconds to wait before giving up (or ASYNCSMP_SHM_FOREVER)
+ * @return true if a message was received, false otherwise
+ */
+bool asyncsmp_shm_receive(asyncsmp_shm_t *shm, uint16_t endpoint, asyncsmp_shm_msg_t *msg, uint32_t timeout_ms);
+
+/**
+ * @brief Callback a shared memory request.
+ *
+ * Sends the request back to its reply endpoint, with the reply message type.
+ *
+ * @param[in] shm Transport
+ * @param[in] req Request
+ * @param[in] ret Return code of the operation
+ */
+void asyncsmp_shm_cb(asyncsmp_shm_t *shm, asyncsmp_shm_req_t *req, int8_t ret);
+
+/**
+ * @brief Offset of an address within the shared memory object.
+ * @param[in] shm Transport
+ * @param[in] ptr Address within the local mapping (or NULL)
+ * @return Offset (0 for NULL)
+ */
+uint32_t asyncsmp_shm_offset(asyncsmp_shm_t *shm, const void *ptr);
+
+/**
+ * @brief Address of an offset within the local mapping.
+ * @param[in] shm Transport
+ * @param[in] offset Offset (or 0)
+ * @return Address (NULL for 0)
+ */
+void *asyncsmp_shm_ptr(asyncsmp_shm_t *shm, uint32_t offset);
+
+#ifdef __cplusplus
+}
+#endif
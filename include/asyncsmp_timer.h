@@ -0,0 +1,78 @@
+/**
+ * Copyright 2021 Michele Riva
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#pragma once
+
+#include <asyncsmp.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Start the timer service.
+ * 
+ * The timer service keeps armed timers in a hierarchical timing wheel, so that arming
+ * and cancelling are constant time operations, and fires expired timers in batches from a single task.
+ * It must be started once before arming any timer.
+ * 
+ * @param[in] stacksize Stack size of the timer service task
+ * @param[in] priority Priority of the timer service task
+ * @return true if the service is running, false otherwise
+ */
+bool asyncsmp_timer_init(uint32_t stacksize, uint32_t priority);
+
+/**
+ * @brief Callback a request with a return code after a delay.
+ * 
+ * Receivers can use this to complete a request later without keeping a task busy.
+ * The timer is cancelled if the request is called back earlier via asyncsmp_cb().
+ * 
+ * @param[in] req Request to callback
+ * @param[in] ret Return code of the operation
+ * @param[in] ticks Ticks to wait before calling back
+ * @return true if the timer was armed, false otherwise
+ */
+bool asyncsmp_timer_cb_after(asyncsmp_req_t *req, int8_t ret, TickType_t ticks);
+
+/**
+ * @brief Attach a deadline to a request.
+ * 
+ * If the request is not called back within the deadline, it is called back with the given return code.
+ * The late callback from the receiver is then ignored.
+ * 
+ * @warning The receiver still holds the request after the deadline, so it must not be freed until the receiver called it back.
+ * 
+ * @param[in] req Request
+ * @param[in] ret Return code to callback with when the deadline expires
+ * @param[in] ticks Ticks before the deadline expires
+ * @return true if the deadline was armed, false otherwise
+ */
+bool asyncsmp_timer_deadline(asyncsmp_req_t *req, int8_t ret, TickType_t ticks);
+
+/**
+ * @brief Cancel the timer armed on a request.
+ * 
+ * Requests are cancelled automatically when freed.
+ * 
+ * @param[in] req Request
+ * @return true if a timer was cancelled before expiring, false otherwise
+ */
+bool asyncsmp_timer_cancel(asyncsmp_req_t *req);
+
+#ifdef __cplusplus
+}
+#endif
@@ -14,28 +14,445 @@
  *  limitations under the License.
  */
 #include <asyncsmp.h>
+#include <asyncsmp_timer.h>
+#if CONFIG_SPIRAM
+#include <esp_heap_caps.h>
+#endif
+#if portNUM_PROCESSORS > 1
+#include <esp_cpu.h>
+#endif
+#include "asyncsmp_priv.h"
 
 static void _asyncsmp_cb_sem(asyncsmp_req_t *req);
 static void _asyncsmp_cb_tn(asyncsmp_req_t *req);
 static void _asyncsmp_cb_qmsg(asyncsmp_req_t *req);
 static void _asyncsmp_cb_eg(asyncsmp_req_t *req);
 static void _asyncsmp_cb_noawait(asyncsmp_req_t *req);
+static void _asyncsmp_cb_stream(asyncsmp_req_t *req);
+static void _asyncsmp_stream_release(asyncsmp_req_t *req);
 static void _asyncsmp_exec_task(void *args);
 
-asyncsmp_req_t *asyncsmp_req_alloc_custom(asyncsmp_cb_t cb, void *cb_args, size_t data_size)
+static void *_asyncsmp_default_alloc(asyncsmp_mem_t mem, size_t size, void *ctx)
+{
+    return calloc(1, size);
+}
+
+static void _asyncsmp_default_free(asyncsmp_mem_t mem, void *ptr, void *ctx)
+{
+    free(ptr);
+}
+
+const asyncsmp_allocator_t asyncsmp_allocator_default = {
+    .alloc = _asyncsmp_default_alloc,
+    .free = _asyncsmp_default_free};
+
+#if CONFIG_SPIRAM
+static void *_asyncsmp_psram_alloc(asyncsmp_mem_t mem, size_t size, void *ctx)
+{
+    if (mem == ASYNCSMP_MEM_DATA)
+    {
+        void *ptr = heap_caps_calloc(1, size, MALLOC_CAP_SPIRAM);
+        if (ptr)
+            return ptr;
+        return heap_caps_calloc(1, size, MALLOC_CAP_8BIT);
+    }
+    return heap_caps_calloc(1, size, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+}
+
+static void _asyncsmp_psram_free(asyncsmp_mem_t mem, void *ptr, void *ctx)
+{
+    heap_caps_free(ptr);
+}
+
+const asyncsmp_allocator_t asyncsmp_allocator_psram = {
+    .alloc = _asyncsmp_psram_alloc,
+    .free = _asyncsmp_psram_free};
+#else
+// Without PSRAM all memory is internal, and heap_caps may not be available (Linux target)
+const asyncsmp_allocator_t asyncsmp_allocator_psram = {
+    .alloc = _asyncsmp_default_alloc,
+    .free = _asyncsmp_default_free};
+#endif
+
+static const asyncsmp_allocator_t *_asyncsmp_allocator = &asyncsmp_allocator_default;
+
+void asyncsmp_set_allocator(const asyncsmp_allocator_t *allocator)
+{
+    __atomic_store_n(&_asyncsmp_allocator, allocator ? allocator : &asyncsmp_allocator_default, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * @brief Internal allocator selection
+ *
+ * Returns the allocator passed on the call if any, the global one otherwise.
+ */
+static inline const asyncsmp_allocator_t *_asyncsmp_get_allocator(const asyncsmp_allocator_t *allocator)
+{
+    return allocator ? allocator : __atomic_load_n(&_asyncsmp_allocator, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * @brief Internal memory release
+ *
+ * Arena allocators have no free hook, their memory is released all at once.
+ */
+static inline void _asyncsmp_mem_free(const asyncsmp_allocator_t *allocator, asyncsmp_mem_t mem, void *ptr)
 {
-    asyncsmp_req_t *req = calloc(1, sizeof(asyncsmp_req_t));
+    if (allocator->free)
+        allocator->free(mem, ptr, allocator->ctx);
+}
+
+/**
+ * @brief Internal request allocation
+ *
+ * Allocates a zeroed request and its data, and marks it as touched by the current core.
+ */
+static asyncsmp_req_t *_asyncsmp_req_alloc(const asyncsmp_allocator_t *allocator, size_t data_size)
+{
+    allocator = _asyncsmp_get_allocator(allocator);
+    asyncsmp_req_t *req = allocator->alloc(ASYNCSMP_MEM_REQ, sizeof(asyncsmp_req_t), allocator->ctx);
     if (!req)
         return NULL;
     if (data_size)
     {
-        req->data = calloc(1, data_size);
+        req->data = allocator->alloc(ASYNCSMP_MEM_DATA, data_size, allocator->ctx);
         if (!req->data)
         {
-            free(req);
+            _asyncsmp_mem_free(allocator, ASYNCSMP_MEM_REQ, req);
             return NULL;
         }
     }
+    req->allocator = allocator;
+    req->core = xPortGetCoreID();
+#if CONFIG_ASYNCSMP_PRIO_INHERIT
+    req->prio = uxTaskPriorityGet(NULL);
+#endif
+#if CONFIG_ASYNCSMP_REGISTRY
+    if (allocator->free)
+        _asyncsmp_registry_add(req);
+#endif
+    return req;
+}
+
+/**
+ * @brief Internal callback arguments allocation
+ *
+ * Arguments allocated here are owned by the request, and released along with it.
+ */
+static inline void *_asyncsmp_args_alloc(asyncsmp_req_t *req, size_t size)
+{
+    req->cb_args = req->allocator->alloc(ASYNCSMP_MEM_CB_ARGS, size, req->allocator->ctx);
+    if (req->cb_args)
+        __atomic_fetch_or(&req->state, ASYNCSMP_STATE_ARGS, __ATOMIC_RELAXED);
+    return req->cb_args;
+}
+
+/**
+ * @brief Internal request memory release
+ */
+static void _asyncsmp_req_release(asyncsmp_req_t *req)
+{
+    const asyncsmp_allocator_t *allocator = req->allocator;
+    if (__atomic_load_n(&req->state, __ATOMIC_RELAXED) & ASYNCSMP_STATE_ARGS)
+    {
+        if (req->cb == _asyncsmp_cb_stream)
+            _asyncsmp_stream_release(req);
+        _asyncsmp_mem_free(allocator, ASYNCSMP_MEM_CB_ARGS, req->cb_args);
+    }
+    if (req->data)
+        _asyncsmp_mem_free(allocator, ASYNCSMP_MEM_DATA, req->data);
+    _asyncsmp_mem_free(allocator, ASYNCSMP_MEM_REQ, req);
+}
+
+static uint32_t _asyncsmp_reclaim_retired;
+static uint32_t _asyncsmp_reclaim_reclaimed;
+static uint32_t _asyncsmp_reclaim_batches;
+
+#if CONFIG_ASYNCSMP_DEFERRED_FREE
+/**
+ * @brief Deferred reclamation
+ *
+ * Released requests are pushed on a lock-free list of the releasing core, and freed in batches
+ * along with their data and callback arguments by a low priority reclaimer task started on first use.
+ * Lists are only ever emptied as a whole, and retired requests are linked through their parent field.
+ */
+#define ASYNCSMP_RECLAIM_STACK 2048
+#define ASYNCSMP_RECLAIM_IDLE 0
+#define ASYNCSMP_RECLAIM_STARTING 1
+#define ASYNCSMP_RECLAIM_RUNNING 2
+#define ASYNCSMP_RECLAIM_FAILED 3
+static asyncsmp_req_t *_asyncsmp_retired[portNUM_PROCESSORS];
+static uint32_t _asyncsmp_retired_len[portNUM_PROCESSORS];
+static TaskHandle_t _asyncsmp_reclaimer;
+static uint8_t _asyncsmp_reclaimer_state;
+
+static void _asyncsmp_reclaim_task(void *args)
+{
+    while (true)
+    {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(CONFIG_ASYNCSMP_DEFERRED_FREE_IDLE_MS));
+        asyncsmp_reclaim();
+    }
+}
+
+/**
+ * @brief Start the reclaimer task once
+ *
+ * Requests released while it is starting, or if it could not be started, are freed right away.
+ */
+static bool _asyncsmp_reclaimer_start(void)
+{
+    uint8_t state = __atomic_load_n(&_asyncsmp_reclaimer_state, __ATOMIC_ACQUIRE);
+    if (state == ASYNCSMP_RECLAIM_RUNNING)
+        return true;
+    if (state != ASYNCSMP_RECLAIM_IDLE || !__atomic_compare_exchange_n(&_asyncsmp_reclaimer_state, &state, ASYNCSMP_RECLAIM_STARTING, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        return false;
+    bool started = xTaskCreate(_asyncsmp_reclaim_task, "asyncsmp_reclaim", ASYNCSMP_RECLAIM_STACK, NULL, CONFIG_ASYNCSMP_DEFERRED_FREE_PRIORITY, &_asyncsmp_reclaimer) == pdPASS;
+    __atomic_store_n(&_asyncsmp_reclaimer_state, started ? ASYNCSMP_RECLAIM_RUNNING : ASYNCSMP_RECLAIM_FAILED, __ATOMIC_RELEASE);
+    return started;
+}
+
+/**
+ * @brief Push a request on the retire list of the current core
+ */
+static bool _asyncsmp_retire(asyncsmp_req_t *req)
+{
+    if (!_asyncsmp_reclaimer_start())
+        return false;
+    BaseType_t core = xPortGetCoreID();
+    asyncsmp_req_t *head = __atomic_load_n(&_asyncsmp_retired[core], __ATOMIC_RELAXED);
+    do
+        req->parent = head;
+    while (!__atomic_compare_exchange_n(&_asyncsmp_retired[core], &head, req, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    __atomic_fetch_add(&_asyncsmp_reclaim_retired, 1, __ATOMIC_RELAXED);
+    if (__atomic_add_fetch(&_asyncsmp_retired_len[core], 1, __ATOMIC_RELAXED) == CONFIG_ASYNCSMP_DEFERRED_FREE_BATCH)
+        xTaskNotifyGive(_asyncsmp_reclaimer);
+    return true;
+}
+#endif
+
+size_t asyncsmp_reclaim(void)
+{
+    size_t count = 0;
+#if CONFIG_ASYNCSMP_DEFERRED_FREE
+    for (size_t core = 0; core < portNUM_PROCESSORS; core++)
+    {
+        asyncsmp_req_t *req = __atomic_exchange_n(&_asyncsmp_retired[core], NULL, __ATOMIC_ACQUIRE);
+        uint32_t len = 0;
+        while (req)
+        {
+            asyncsmp_req_t *next = req->parent;
+            _asyncsmp_req_release(req);
+            req = next;
+            len++;
+        }
+        __atomic_fetch_sub(&_asyncsmp_retired_len[core], len, __ATOMIC_RELAXED);
+        count += len;
+    }
+    if (count)
+    {
+        __atomic_fetch_add(&_asyncsmp_reclaim_reclaimed, count, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&_asyncsmp_reclaim_batches, 1, __ATOMIC_RELAXED);
+    }
+#endif
+    return count;
+}
+
+void asyncsmp_reclaim_stats(asyncsmp_reclaim_stats_t *stats)
+{
+    stats->retired = __atomic_load_n(&_asyncsmp_reclaim_retired, __ATOMIC_RELAXED);
+    stats->reclaimed = __atomic_load_n(&_asyncsmp_reclaim_reclaimed, __ATOMIC_RELAXED);
+    stats->batches = __atomic_load_n(&_asyncsmp_reclaim_batches, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Internal request release
+ *
+ * Cancels any timer still armed on the request, then frees its data and the request itself,
+ * or retires them to the reclaimer if deferred reclamation is enabled.
+ */
+static void _asyncsmp_req_free(asyncsmp_req_t *req)
+{
+    if (__atomic_load_n(&req->state, __ATOMIC_SEQ_CST) & ASYNCSMP_STATE_TIMED)
+        asyncsmp_timer_cancel(req);
+#if CONFIG_ASYNCSMP_REGISTRY
+    if (req->allocator->free)
+        _asyncsmp_registry_remove(req);
+#endif
+#if CONFIG_ASYNCSMP_DEFERRED_FREE
+    if (req->allocator->free && _asyncsmp_retire(req))
+        return;
+#endif
+    _asyncsmp_req_release(req);
+}
+
+/**
+ * @brief Internal completion signal
+ *
+ * Marks the request as completed, releasing the claim of a delayed callback being fired in the same step.
+ * It must be called before waking up the awaiter, as the request may be released as soon as the awaiter wakes up.
+ */
+static inline uint8_t _asyncsmp_req_signal(asyncsmp_req_t *req)
+{
+    // Claim the waiter before flagging, so that it stays around until given
+    SemaphoreHandle_t waiter = __atomic_exchange_n(&req->waiter, NULL, __ATOMIC_SEQ_CST);
+    uint8_t state = __atomic_load_n(&req->state, __ATOMIC_SEQ_CST);
+    while (!__atomic_compare_exchange_n(&req->state, &state, (state | ASYNCSMP_STATE_DONE) & ~ASYNCSMP_STATE_FIRING, true, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+        ;
+    if (waiter)
+        xSemaphoreGive(waiter);
+    return state;
+}
+
+/**
+ * @brief Semaphore pool
+ *
+ * Semaphore requests only need a kernel object when their awaiter actually blocks.
+ * Such objects are taken from this pool, and returned empty once the awaiter wakes up.
+ */
+#define ASYNCSMP_SEM_POOL_SIZE 8
+static SemaphoreHandle_t _asyncsmp_sem_pool[ASYNCSMP_SEM_POOL_SIZE];
+static size_t _asyncsmp_sem_pooled;
+static portMUX_TYPE _asyncsmp_sem_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static SemaphoreHandle_t _asyncsmp_sem_get(void)
+{
+    SemaphoreHandle_t sem = NULL;
+    portENTER_CRITICAL(&_asyncsmp_sem_lock);
+    if (_asyncsmp_sem_pooled)
+        sem = _asyncsmp_sem_pool[--_asyncsmp_sem_pooled];
+    portEXIT_CRITICAL(&_asyncsmp_sem_lock);
+    return sem ? sem : xSemaphoreCreateBinary();
+}
+
+static void _asyncsmp_sem_put(SemaphoreHandle_t sem)
+{
+    portENTER_CRITICAL(&_asyncsmp_sem_lock);
+    if (_asyncsmp_sem_pooled < ASYNCSMP_SEM_POOL_SIZE)
+    {
+        _asyncsmp_sem_pool[_asyncsmp_sem_pooled++] = sem;
+        sem = NULL;
+    }
+    portEXIT_CRITICAL(&_asyncsmp_sem_lock);
+    if (sem)
+        vSemaphoreDelete(sem);
+}
+
+/**
+ * @brief Adaptive spin tuning
+ *
+ * Completion times of adaptive awaits are measured in CPU cycles, both when the request completed
+ * while spinning and when the awaiter had to block, and averaged with a 1/8 weight. The budget follows
+ * the average while it stays below the cost of a block/unblock round trip, beyond which spinning does
+ * not pay off and the budget drops to the minimum. Estimates are shared by all awaiting tasks:
+ * concurrent updates may lose a sample, but are never torn.
+ */
+#ifdef CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ
+#define ASYNCSMP_SPIN_MHZ CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ
+#else
+#define ASYNCSMP_SPIN_MHZ 160
+#endif
+#define ASYNCSMP_SPIN_MIN (1 * ASYNCSMP_SPIN_MHZ)    // 1us
+#define ASYNCSMP_SPIN_BLOCK (10 * ASYNCSMP_SPIN_MHZ) // 10us, block/unblock round trip
+typedef struct _asyncsmp_spin
+{
+    uint32_t awaits;
+    uint32_t hits;
+    uint32_t avg;
+} _asyncsmp_spin_t;
+static _asyncsmp_spin_t _asyncsmp_spin_sem;
+static _asyncsmp_spin_t _asyncsmp_spin_tn;
+
+/**
+ * @brief Start of an adaptive await
+ *
+ * Cycle counters are per core, so the core is recorded along with them.
+ */
+typedef struct _asyncsmp_spin_start
+{
+    uint32_t cycles;
+    TickType_t tick;
+    BaseType_t core;
+} _asyncsmp_spin_start_t;
+
+static uint32_t _asyncsmp_spin_budget(const _asyncsmp_spin_t *spin)
+{
+    uint32_t avg = __atomic_load_n(&spin->avg, __ATOMIC_RELAXED);
+    if (avg >= ASYNCSMP_SPIN_BLOCK)
+        return ASYNCSMP_SPIN_MIN;
+    uint32_t budget = avg + avg / 2;
+    return budget < ASYNCSMP_SPIN_MIN ? ASYNCSMP_SPIN_MIN : budget > ASYNCSMP_SPIN_BLOCK ? ASYNCSMP_SPIN_BLOCK : budget;
+}
+
+#if portNUM_PROCESSORS > 1
+static void _asyncsmp_spin_record(_asyncsmp_spin_t *spin, uint32_t cycles)
+{
+    // Anything slower than twice a round trip counts the same, so the average recovers quickly
+    if (cycles > 2 * ASYNCSMP_SPIN_BLOCK)
+        cycles = 2 * ASYNCSMP_SPIN_BLOCK;
+    uint32_t avg = __atomic_load_n(&spin->avg, __ATOMIC_RELAXED);
+    __atomic_store_n(&spin->avg, avg + ((int32_t)cycles - (int32_t)avg) / 8, __ATOMIC_RELAXED);
+}
+#endif
+
+/**
+ * @brief Spin on the request completion flag
+ *
+ * Returns true if the request completed within the spin budget, recording its completion time.
+ * Otherwise the start of the await is left in start, for _asyncsmp_spin_blocked to record it
+ * once the awaiter wakes up. Spinning is pointless on single core targets.
+ */
+static bool _asyncsmp_spin(_asyncsmp_spin_t *spin, asyncsmp_req_t *req, _asyncsmp_spin_start_t *start)
+{
+    __atomic_fetch_add(&spin->awaits, 1, __ATOMIC_RELAXED);
+#if portNUM_PROCESSORS > 1
+    start->core = xPortGetCoreID();
+    start->tick = xTaskGetTickCount();
+    start->cycles = esp_cpu_get_cycle_count();
+    uint32_t budget = _asyncsmp_spin_budget(spin);
+    uint32_t elapsed = 0;
+    while (elapsed < budget)
+    {
+        if (__atomic_load_n(&req->state, __ATOMIC_ACQUIRE) & ASYNCSMP_STATE_DONE)
+        {
+            __atomic_fetch_add(&spin->hits, 1, __ATOMIC_RELAXED);
+            _asyncsmp_spin_record(spin, elapsed);
+            return true;
+        }
+        elapsed = esp_cpu_get_cycle_count() - start->cycles;
+    }
+#endif
+    return false;
+}
+
+/**
+ * @brief Record the completion time of an adaptive await which did not complete while spinning
+ *
+ * Samples are dropped if the awaiter moved to another core, and waits longer than a tick
+ * are recorded as too slow to spin for, as the cycle counter may have wrapped.
+ */
+static void _asyncsmp_spin_blocked(_asyncsmp_spin_t *spin, const _asyncsmp_spin_start_t *start)
+{
+#if portNUM_PROCESSORS > 1
+    if (xPortGetCoreID() != start->core)
+        return;
+    if (xTaskGetTickCount() - start->tick > 1)
+        _asyncsmp_spin_record(spin, UINT32_MAX);
+    else
+        _asyncsmp_spin_record(spin, esp_cpu_get_cycle_count() - start->cycles);
+#endif
+}
+
+asyncsmp_req_t *asyncsmp_req_alloc_custom(asyncsmp_cb_t cb, void *cb_args, size_t data_size)
+{
+    return asyncsmp_req_alloc_custom_ex(NULL, cb, cb_args, data_size);
+}
+
+asyncsmp_req_t *asyncsmp_req_alloc_custom_ex(const asyncsmp_allocator_t *allocator, asyncsmp_cb_t cb, void *cb_args, size_t data_size)
+{
+    asyncsmp_req_t *req = _asyncsmp_req_alloc(allocator, data_size);
+    if (!req)
+        return NULL;
     req->cb = cb;
     req->cb_args = cb_args;
     return req;
@@ -45,8 +462,7 @@ void asyncsmp_req_free_custom(asyncsmp_req_t *req)
 {
     if (req)
     {
-        free(req->data);
-        free(req);
+        _asyncsmp_req_free(req);
     }
 }
 
@@ -58,24 +474,18 @@ typedef struct asyncsmp_qmsg_args
 } asyncsmp_qmsg_args_t;
 asyncsmp_req_t *asyncsmp_req_alloc_qmsg(QueueHandle_t queue, asyncsmp_enum_t msg_type, SemaphoreHandle_t queue_guard, size_t data_size)
 {
-    asyncsmp_req_t *req = calloc(1, sizeof(asyncsmp_req_t));
+    return asyncsmp_req_alloc_qmsg_ex(NULL, queue, msg_type, queue_guard, data_size);
+}
+
+asyncsmp_req_t *asyncsmp_req_alloc_qmsg_ex(const asyncsmp_allocator_t *allocator, QueueHandle_t queue, asyncsmp_enum_t msg_type, SemaphoreHandle_t queue_guard, size_t data_size)
+{
+    asyncsmp_req_t *req = _asyncsmp_req_alloc(allocator, data_size);
     if (!req)
         return NULL;
-    if (data_size)
-    {
-        req->data = calloc(1, data_size);
-        if (!req->data)
-        {
-            free(req);
-            return NULL;
-        }
-    }
     req->cb = _asyncsmp_cb_qmsg;
-    req->cb_args = malloc(sizeof(asyncsmp_qmsg_args_t));
-    if (!req->cb_args)
+    if (!_asyncsmp_args_alloc(req, sizeof(asyncsmp_qmsg_args_t)))
     {
-        free(req->data);
-        free(req);
+        _asyncsmp_req_free(req);
         return NULL;
     }
     ((asyncsmp_qmsg_args_t *)req->cb_args)->type = msg_type;
@@ -88,66 +498,104 @@ void asyncsmp_req_free_qmsg(asyncsmp_req_t *req)
 {
     if (req)
     {
-        free(req->cb_args);
-        free(req->data);
-        free(req);
+        _asyncsmp_req_free(req);
     }
 }
 
 asyncsmp_req_t *asyncsmp_req_alloc_sem(size_t data_size)
 {
-    asyncsmp_req_t *req = calloc(1, sizeof(asyncsmp_req_t));
+    return asyncsmp_req_alloc_sem_ex(NULL, data_size);
+}
+
+asyncsmp_req_t *asyncsmp_req_alloc_sem_ex(const asyncsmp_allocator_t *allocator, size_t data_size)
+{
+    asyncsmp_req_t *req = _asyncsmp_req_alloc(allocator, data_size);
     if (!req)
         return NULL;
-    if (data_size)
+    req->cb = _asyncsmp_cb_sem;
+    return req;
+}
+
+bool asyncsmp_await_sem(asyncsmp_req_t *req, TickType_t ticks)
+{
+    // Fast path, already completed
+    if (__atomic_fetch_and(&req->state, ~ASYNCSMP_STATE_DONE, __ATOMIC_SEQ_CST) & ASYNCSMP_STATE_DONE)
+        return true;
+    if (!ticks)
+        return false;
+
+    SemaphoreHandle_t sem = _asyncsmp_sem_get();
+    if (!sem)
     {
-        req->data = calloc(1, data_size);
-        if (!req->data)
+        // No kernel object available, fall back to polling
+        TickType_t start = xTaskGetTickCount();
+        while (!(__atomic_fetch_and(&req->state, ~ASYNCSMP_STATE_DONE, __ATOMIC_SEQ_CST) & ASYNCSMP_STATE_DONE))
         {
-            free(req);
-            return NULL;
+            if (ticks != portMAX_DELAY && xTaskGetTickCount() - start >= ticks)
+                return false;
+            vTaskDelay(1);
         }
+        return true;
     }
-    req->cb = _asyncsmp_cb_sem;
-    req->cb_args = (void *)xSemaphoreCreateBinary();
-    if (!req->cb_args)
+
+    // Publish the semaphore, then flag the awaiter as blocked unless completed in the meantime
+    req->cb_args = sem;
+    uint8_t state = __atomic_load_n(&req->state, __ATOMIC_SEQ_CST);
+    do
     {
-        free(req->data);
-        free(req);
-        return NULL;
+        if (state & ASYNCSMP_STATE_DONE)
+        {
+            __atomic_fetch_and(&req->state, ~ASYNCSMP_STATE_DONE, __ATOMIC_SEQ_CST);
+            req->cb_args = NULL;
+            _asyncsmp_sem_put(sem);
+            return true;
+        }
+    } while (!__atomic_compare_exchange_n(&req->state, &state, state | ASYNCSMP_STATE_BLOCKED, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+
+    bool done = xSemaphoreTake(sem, ticks) == pdTRUE;
+    if (!done && __atomic_fetch_and(&req->state, ~ASYNCSMP_STATE_BLOCKED, __ATOMIC_SEQ_CST) & ASYNCSMP_STATE_DONE)
+    {
+        // Completed while timing out, the semaphore is being given
+        xSemaphoreTake(sem, portMAX_DELAY);
+        done = true;
     }
-    return req;
+    if (done)
+        __atomic_fetch_and(&req->state, ~(ASYNCSMP_STATE_DONE | ASYNCSMP_STATE_BLOCKED), __ATOMIC_SEQ_CST);
+    req->cb_args = NULL;
+    _asyncsmp_sem_put(sem);
+    return done;
 }
 
-bool asyncsmp_await_sem(asyncsmp_req_t *req, TickType_t ticks)
+bool asyncsmp_await_sem_adaptive(asyncsmp_req_t *req, TickType_t ticks)
 {
-    return xSemaphoreTake((SemaphoreHandle_t)req->cb_args, ticks) == pdTRUE;
+    _asyncsmp_spin_start_t start;
+    // Once flagged, the await returns right away
+    if (_asyncsmp_spin(&_asyncsmp_spin_sem, req, &start))
+        return asyncsmp_await_sem(req, ticks);
+    if (!asyncsmp_await_sem(req, ticks))
+        return false;
+    _asyncsmp_spin_blocked(&_asyncsmp_spin_sem, &start);
+    return true;
 }
 
 void asyncsmp_req_free_sem(asyncsmp_req_t *req)
 {
     if (req)
     {
-        vSemaphoreDelete((SemaphoreHandle_t)req->cb_args);
-        free(req->data);
-        free(req);
+        _asyncsmp_req_free(req);
     }
 }
 
 asyncsmp_req_t *asyncsmp_req_alloc_tn(size_t data_size)
 {
-    asyncsmp_req_t *req = calloc(1, sizeof(asyncsmp_req_t));
+    return asyncsmp_req_alloc_tn_ex(NULL, data_size);
+}
+
+asyncsmp_req_t *asyncsmp_req_alloc_tn_ex(const asyncsmp_allocator_t *allocator, size_t data_size)
+{
+    asyncsmp_req_t *req = _asyncsmp_req_alloc(allocator, data_size);
     if (!req)
         return NULL;
-    if (data_size)
-    {
-        req->data = calloc(1, data_size);
-        if (!req->data)
-        {
-            free(req);
-            return NULL;
-        }
-    }
     req->cb = _asyncsmp_cb_tn;
     req->cb_args = xTaskGetCurrentTaskHandle();
     return req;
@@ -158,12 +606,41 @@ bool asyncsmp_await_tn(TickType_t ticks)
     return ulTaskNotifyTake(pdTRUE, ticks) != 0;
 }
 
+bool asyncsmp_await_tn_adaptive(asyncsmp_req_t *req, TickType_t ticks)
+{
+    _asyncsmp_spin_start_t start;
+    // Once flagged, the notification is given right away
+    bool spun = _asyncsmp_spin(&_asyncsmp_spin_tn, req, &start);
+    if (!asyncsmp_await_tn(spun ? portMAX_DELAY : ticks))
+        return false;
+    if (!spun)
+        _asyncsmp_spin_blocked(&_asyncsmp_spin_tn, &start);
+    __atomic_fetch_and(&req->state, ~ASYNCSMP_STATE_DONE, __ATOMIC_SEQ_CST);
+    return true;
+}
+
+static void _asyncsmp_spin_stats(const _asyncsmp_spin_t *spin, asyncsmp_spin_stats_t *stats)
+{
+    stats->awaits = __atomic_load_n(&spin->awaits, __ATOMIC_RELAXED);
+    stats->spin_hits = __atomic_load_n(&spin->hits, __ATOMIC_RELAXED);
+    stats->budget = _asyncsmp_spin_budget(spin);
+}
+
+void asyncsmp_spin_stats_sem(asyncsmp_spin_stats_t *stats)
+{
+    _asyncsmp_spin_stats(&_asyncsmp_spin_sem, stats);
+}
+
+void asyncsmp_spin_stats_tn(asyncsmp_spin_stats_t *stats)
+{
+    _asyncsmp_spin_stats(&_asyncsmp_spin_tn, stats);
+}
+
 void asyncsmp_req_free_tn(asyncsmp_req_t *req)
 {
     if (req)
     {
-        free(req->data);
-        free(req);
+        _asyncsmp_req_free(req);
     }
 }
 
@@ -174,23 +651,17 @@ typedef struct asyncsmp_eg_args
 } asyncsmp_eg_args_t;
 asyncsmp_req_t *asyncsmp_req_alloc_eg(EventGroupHandle_t eg, EventBits_t eb, size_t data_size)
 {
-    asyncsmp_req_t *req = calloc(1, sizeof(asyncsmp_req_t));
+    return asyncsmp_req_alloc_eg_ex(NULL, eg, eb, data_size);
+}
+
+asyncsmp_req_t *asyncsmp_req_alloc_eg_ex(const asyncsmp_allocator_t *allocator, EventGroupHandle_t eg, EventBits_t eb, size_t data_size)
+{
+    asyncsmp_req_t *req = _asyncsmp_req_alloc(allocator, data_size);
     if (!req)
         return NULL;
-    if (data_size)
+    if (!_asyncsmp_args_alloc(req, sizeof(asyncsmp_eg_args_t)))
     {
-        req->data = calloc(1, data_size);
-        if (!req->data)
-        {
-            free(req);
-            return NULL;
-        }
-    }
-    req->cb_args = calloc(1, sizeof(asyncsmp_eg_args_t));
-    if (!req->cb_args)
-    {
-        free(req->data);
-        free(req);
+        _asyncsmp_req_free(req);
         return NULL;
     }
     req->cb = _asyncsmp_cb_eg;
@@ -213,26 +684,346 @@ void asyncsmp_req_free_eg(asyncsmp_req_t *req)
 {
     if (req)
     {
-        free(req->cb_args);
-        free(req->data);
-        free(req);
+        _asyncsmp_req_free(req);
     }
 }
 
-asyncsmp_req_t *asyncsmp_req_alloc_noawait(size_t data_size)
+/**
+ * @brief Stream ring
+ *
+ * Single producer (receiver), single consumer (requester). Free space is the producer credit.
+ * A side about to block raises its waiting flag, and whoever clears it owes a give on its semaphore,
+ * so semaphores are always empty when nobody waits.
+ */
+#define ASYNCSMP_STREAM_ENDED 0x01
+#define ASYNCSMP_STREAM_READER 0x02 // Reader waiting for data
+#define ASYNCSMP_STREAM_WRITER 0x04 // Writer waiting for space
+typedef struct asyncsmp_stream_args
+{
+    SemaphoreHandle_t readable;
+    SemaphoreHandle_t writable;
+    uint32_t size;
+    uint32_t head;
+    uint32_t tail;
+    uint8_t flags;
+    uint8_t *ring;
+} asyncsmp_stream_args_t;
+
+/**
+ * @brief Release the ring of a stream request
+ *
+ * The ring is bulk data, allocated as such apart from the small stream header kept in the callback arguments.
+ */
+static void _asyncsmp_stream_release(asyncsmp_req_t *req)
+{
+    asyncsmp_stream_args_t *stream = (asyncsmp_stream_args_t *)req->cb_args;
+    if (stream->ring)
+        _asyncsmp_mem_free(req->allocator, ASYNCSMP_MEM_DATA, stream->ring);
+}
+
+static bool _asyncsmp_stream_readable(asyncsmp_stream_args_t *stream)
+{
+    return __atomic_load_n(&stream->head, __ATOMIC_ACQUIRE) != stream->tail;
+}
+
+static bool _asyncsmp_stream_writable(asyncsmp_stream_args_t *stream)
+{
+    return stream->head - __atomic_load_n(&stream->tail, __ATOMIC_ACQUIRE) < stream->size;
+}
+
+/**
+ * @brief Ticks left before a timeout started at start
+ */
+static TickType_t _asyncsmp_ticks_left(TickType_t start, TickType_t ticks)
 {
-    asyncsmp_req_t *req = calloc(1, sizeof(asyncsmp_req_t));
+    if (ticks == portMAX_DELAY)
+        return ticks;
+    TickType_t elapsed = xTaskGetTickCount() - start;
+    return elapsed < ticks ? ticks - elapsed : 0;
+}
+
+/**
+ * @brief Wait for the other side of a stream
+ *
+ * @return true if the stream may be ready (or ended), false if timed out
+ */
+static bool _asyncsmp_stream_wait(asyncsmp_stream_args_t *stream, uint8_t waiting, SemaphoreHandle_t sem, bool (*ready)(asyncsmp_stream_args_t *), TickType_t ticks)
+{
+    uint8_t flags = __atomic_load_n(&stream->flags, __ATOMIC_SEQ_CST);
+    do
+    {
+        if (flags & ASYNCSMP_STREAM_ENDED)
+            return true;
+    } while (!__atomic_compare_exchange_n(&stream->flags, &flags, flags | waiting, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+
+    if (!ready(stream) && xSemaphoreTake(sem, ticks) == pdTRUE)
+        return true;
+
+    // Ready in the meantime or timed out, the flag is withdrawn unless a give is already owed
+    if (!(__atomic_fetch_and(&stream->flags, ~waiting, __ATOMIC_SEQ_CST) & waiting))
+        xSemaphoreTake(sem, portMAX_DELAY);
+    return ready(stream);
+}
+
+/**
+ * @brief Wake up the other side of a stream, if waiting
+ */
+static void _asyncsmp_stream_wake(asyncsmp_stream_args_t *stream, uint8_t waiting, SemaphoreHandle_t sem)
+{
+    if (__atomic_fetch_and(&stream->flags, ~waiting, __ATOMIC_SEQ_CST) & waiting)
+        xSemaphoreGive(sem);
+}
+
+asyncsmp_req_t *asyncsmp_req_alloc_stream(size_t ring_size, size_t data_size)
+{
+    return asyncsmp_req_alloc_stream_ex(NULL, ring_size, data_size);
+}
+
+asyncsmp_req_t *asyncsmp_req_alloc_stream_ex(const asyncsmp_allocator_t *allocator, size_t ring_size, size_t data_size)
+{
+    // Larger rings cannot be rounded up within 32 bits
+    if (ring_size > (size_t)1 << 31)
+        return NULL;
+    uint32_t size = 1;
+    while (size < ring_size)
+        size <<= 1;
+    asyncsmp_req_t *req = _asyncsmp_req_alloc(allocator, data_size);
     if (!req)
         return NULL;
-    if (data_size)
+    asyncsmp_stream_args_t *stream = _asyncsmp_args_alloc(req, sizeof(asyncsmp_stream_args_t));
+    if (!stream)
     {
-        req->data = calloc(1, data_size);
-        if (!req->data)
+        _asyncsmp_req_free(req);
+        return NULL;
+    }
+    req->cb = _asyncsmp_cb_stream;
+    stream->ring = req->allocator->alloc(ASYNCSMP_MEM_DATA, size, req->allocator->ctx);
+    if (!stream->ring)
+    {
+        _asyncsmp_req_free(req);
+        return NULL;
+    }
+    stream->size = size;
+    stream->readable = _asyncsmp_sem_get();
+    stream->writable = _asyncsmp_sem_get();
+    if (!stream->readable || !stream->writable)
+    {
+        asyncsmp_req_free_stream(req);
+        return NULL;
+    }
+    return req;
+}
+
+size_t asyncsmp_stream_write(asyncsmp_req_t *req, const void *buf, size_t len, TickType_t ticks)
+{
+    asyncsmp_stream_args_t *stream = (asyncsmp_stream_args_t *)req->cb_args;
+    TickType_t start = xTaskGetTickCount();
+    size_t written = 0;
+    while (written < len)
+    {
+        uint32_t head = stream->head;
+        uint32_t space = stream->size - (head - __atomic_load_n(&stream->tail, __ATOMIC_ACQUIRE));
+        if (!space)
         {
-            free(req);
-            return NULL;
+            TickType_t wait = _asyncsmp_ticks_left(start, ticks);
+            if (!wait || !_asyncsmp_stream_wait(stream, ASYNCSMP_STREAM_WRITER, stream->writable, _asyncsmp_stream_writable, wait))
+                break;
+            continue;
         }
+
+        uint32_t chunk = len - written < space ? len - written : space;
+        uint32_t offset = head & (stream->size - 1);
+        uint32_t first = chunk < stream->size - offset ? chunk : stream->size - offset;
+        memcpy(stream->ring + offset, (const uint8_t *)buf + written, first);
+        memcpy(stream->ring, (const uint8_t *)buf + written + first, chunk - first);
+        __atomic_store_n(&stream->head, head + chunk, __ATOMIC_RELEASE);
+        written += chunk;
+        _asyncsmp_stream_wake(stream, ASYNCSMP_STREAM_READER, stream->readable);
+    }
+    return written;
+}
+
+size_t asyncsmp_stream_read(asyncsmp_req_t *req, void *buf, size_t len, TickType_t ticks)
+{
+    asyncsmp_stream_args_t *stream = (asyncsmp_stream_args_t *)req->cb_args;
+    TickType_t start = xTaskGetTickCount();
+    while (!_asyncsmp_stream_readable(stream))
+    {
+        if (__atomic_load_n(&stream->flags, __ATOMIC_SEQ_CST) & ASYNCSMP_STREAM_ENDED && !_asyncsmp_stream_readable(stream))
+            return 0;
+        TickType_t wait = _asyncsmp_ticks_left(start, ticks);
+        if (!wait || !_asyncsmp_stream_wait(stream, ASYNCSMP_STREAM_READER, stream->readable, _asyncsmp_stream_readable, wait))
+            return 0;
     }
+
+    uint32_t tail = stream->tail;
+    uint32_t available = __atomic_load_n(&stream->head, __ATOMIC_ACQUIRE) - tail;
+    uint32_t chunk = len < available ? len : available;
+    uint32_t offset = tail & (stream->size - 1);
+    uint32_t first = chunk < stream->size - offset ? chunk : stream->size - offset;
+    memcpy(buf, stream->ring + offset, first);
+    memcpy((uint8_t *)buf + first, stream->ring, chunk - first);
+    __atomic_store_n(&stream->tail, tail + chunk, __ATOMIC_RELEASE);
+    _asyncsmp_stream_wake(stream, ASYNCSMP_STREAM_WRITER, stream->writable);
+    return chunk;
+}
+
+bool asyncsmp_stream_ended(asyncsmp_req_t *req)
+{
+    asyncsmp_stream_args_t *stream = (asyncsmp_stream_args_t *)req->cb_args;
+    return __atomic_load_n(&stream->flags, __ATOMIC_SEQ_CST) & ASYNCSMP_STREAM_ENDED && !_asyncsmp_stream_readable(stream);
+}
+
+void asyncsmp_req_free_stream(asyncsmp_req_t *req)
+{
+    if (req)
+    {
+        asyncsmp_stream_args_t *stream = (asyncsmp_stream_args_t *)req->cb_args;
+        if (stream->readable)
+            _asyncsmp_sem_put(stream->readable);
+        if (stream->writable)
+            _asyncsmp_sem_put(stream->writable);
+        _asyncsmp_req_free(req);
+    }
+}
+
+const char *_asyncsmp_req_type(asyncsmp_req_t *req)
+{
+    if (req->cb == _asyncsmp_cb_sem)
+        return "sem";
+    if (req->cb == _asyncsmp_cb_tn)
+        return "tn";
+    if (req->cb == _asyncsmp_cb_qmsg)
+        return "qmsg";
+    if (req->cb == _asyncsmp_cb_eg)
+        return "eg";
+    if (req->cb == _asyncsmp_cb_noawait)
+        return "noawait";
+    if (req->cb == _asyncsmp_cb_stream)
+        return "stream";
+    return "custom";
+}
+
+bool _asyncsmp_req_noawait(asyncsmp_req_t *req)
+{
+    return req->cb == _asyncsmp_cb_noawait;
+}
+
+bool _asyncsmp_req_batchable(asyncsmp_req_t *req)
+{
+    return req->cb == _asyncsmp_cb_sem || req->cb == _asyncsmp_cb_tn || req->cb == _asyncsmp_cb_eg || req->cb == _asyncsmp_cb_stream;
+}
+
+/**
+ * @brief Consume the completion of a flagged request
+ *
+ * The flag is raised right before the awaiter is woken up, so the underlying
+ * primitive is taken without timeout. Semaphore requests only need the flag cleared,
+ * queue messages are left to the receiver.
+ */
+static void _asyncsmp_req_consume(asyncsmp_req_t *req)
+{
+    if (req->cb == _asyncsmp_cb_tn)
+        ulTaskNotifyTake(pdFALSE, portMAX_DELAY);
+    else if (req->cb == _asyncsmp_cb_eg)
+        xEventGroupWaitBits(((asyncsmp_eg_args_t *)req->cb_args)->eg, ((asyncsmp_eg_args_t *)req->cb_args)->eb, pdTRUE, pdTRUE, portMAX_DELAY);
+    __atomic_fetch_and(&req->state, ~ASYNCSMP_STATE_DONE, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * @brief Internal heterogeneous awaiter
+ *
+ * A counting semaphore living on the awaiter stack is registered in every request,
+ * and given by whichever callback claims it first. Before returning, the semaphore
+ * is unregistered and the gives of callbacks which already claimed it are drained.
+ *
+ * @return Index of the first completed request, or -1 if not ready within timeout
+ */
+static int _asyncsmp_await_multi(asyncsmp_req_t **reqs, size_t n, TickType_t ticks, bool all)
+{
+    StaticSemaphore_t buffer;
+    SemaphoreHandle_t waiter = xSemaphoreCreateCountingStatic(n, 0, &buffer);
+    TickType_t start = xTaskGetTickCount();
+    size_t taken = 0;
+    size_t claimed = 0;
+    int first = -1;
+
+    for (size_t i = 0; i < n; i++)
+        __atomic_store_n(&reqs[i]->waiter, waiter, __ATOMIC_SEQ_CST);
+
+    while (true)
+    {
+        size_t done = 0;
+        first = -1;
+        for (size_t i = 0; i < n; i++)
+        {
+            if (__atomic_load_n(&reqs[i]->state, __ATOMIC_SEQ_CST) & ASYNCSMP_STATE_DONE)
+            {
+                if (first < 0)
+                    first = i;
+                done++;
+            }
+        }
+        if (all ? done == n : done > 0)
+            break;
+
+        TickType_t wait = ticks;
+        if (ticks != portMAX_DELAY)
+        {
+            TickType_t elapsed = xTaskGetTickCount() - start;
+            if (elapsed >= ticks)
+            {
+                first = -1;
+                break;
+            }
+            wait = ticks - elapsed;
+        }
+        if (xSemaphoreTake(waiter, wait) == pdTRUE)
+            taken++;
+    }
+
+    for (size_t i = 0; i < n; i++)
+    {
+        if (!__atomic_exchange_n(&reqs[i]->waiter, NULL, __ATOMIC_SEQ_CST))
+            claimed++;
+    }
+    for (; taken < claimed; taken++)
+        xSemaphoreTake(waiter, portMAX_DELAY);
+    vSemaphoreDelete(waiter);
+    return first;
+}
+
+int asyncsmp_await_any(asyncsmp_req_t **reqs, size_t n, TickType_t ticks)
+{
+    if (!n)
+        return -1;
+    int index = _asyncsmp_await_multi(reqs, n, ticks, false);
+    if (index >= 0)
+        _asyncsmp_req_consume(reqs[index]);
+    return index;
+}
+
+bool asyncsmp_await_all(asyncsmp_req_t **reqs, size_t n, TickType_t ticks)
+{
+    if (!n)
+        return true;
+    if (_asyncsmp_await_multi(reqs, n, ticks, true) < 0)
+        return false;
+    for (size_t i = 0; i < n; i++)
+        _asyncsmp_req_consume(reqs[i]);
+    return true;
+}
+
+asyncsmp_req_t *asyncsmp_req_alloc_noawait(size_t data_size)
+{
+    return asyncsmp_req_alloc_noawait_ex(NULL, data_size);
+}
+
+asyncsmp_req_t *asyncsmp_req_alloc_noawait_ex(const asyncsmp_allocator_t *allocator, size_t data_size)
+{
+    asyncsmp_req_t *req = _asyncsmp_req_alloc(allocator, data_size);
+    if (!req)
+        return NULL;
     req->cb = _asyncsmp_cb_noawait;
     return req;
 }
@@ -241,32 +1032,234 @@ void asyncsmp_cb(asyncsmp_req_t *req, int8_t ret)
 {
     if (req)
     {
-        req->ret = ret;
-        req->cb(req);
+        // Requests with timers are completed only if they were not completed by the timer already
+        if (__atomic_load_n(&req->state, __ATOMIC_SEQ_CST) & (ASYNCSMP_STATE_TIMED | ASYNCSMP_STATE_EXPIRED | ASYNCSMP_STATE_FIRING) && !_asyncsmp_timer_claim(req))
+            return;
+        _asyncsmp_cb(req, ret);
     }
 }
 
+void asyncsmp_req_reset(asyncsmp_req_t *req)
+{
+    __atomic_fetch_and(&req->state, ~(ASYNCSMP_STATE_DONE | ASYNCSMP_STATE_FIRING), __ATOMIC_SEQ_CST);
+}
+
+void _asyncsmp_cb(asyncsmp_req_t *req, int8_t ret)
+{
+    req->ret = ret;
+    req->core = xPortGetCoreID();
+    req->cb(req);
+}
+
 typedef struct _asyncsmp_exec_args
 {
     asyncsmp_fn_t fn;
     asyncsmp_req_t *req;
+    const asyncsmp_allocator_t *allocator;
+    uint32_t stacksize;
+    void (*done)(void *ctx);
+    void *ctx;
 } _asyncsmp_exec_args_t;
+
+#if CONFIG_ASYNCSMP_STACK_PROFILE
+/**
+ * @brief Stack profile table
+ *
+ * Open addressing table keyed by function, entries are never removed.
+ */
+static asyncsmp_stack_profile_t _asyncsmp_stack_profiles[CONFIG_ASYNCSMP_STACK_PROFILE_SIZE];
+static portMUX_TYPE _asyncsmp_stack_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static asyncsmp_stack_profile_t *_asyncsmp_stack_profile(asyncsmp_fn_t fn, bool insert)
+{
+    size_t start = ((uintptr_t)fn >> 2) % CONFIG_ASYNCSMP_STACK_PROFILE_SIZE;
+    for (size_t i = 0; i < CONFIG_ASYNCSMP_STACK_PROFILE_SIZE; i++)
+    {
+        asyncsmp_stack_profile_t *profile = &_asyncsmp_stack_profiles[(start + i) % CONFIG_ASYNCSMP_STACK_PROFILE_SIZE];
+        if (profile->fn == fn)
+            return profile;
+        if (!profile->fn)
+        {
+            if (!insert)
+                return NULL;
+            profile->fn = fn;
+            return profile;
+        }
+    }
+    return NULL;
+}
+
+static void _asyncsmp_stack_record(asyncsmp_fn_t fn, uint32_t stacksize, uint32_t used)
+{
+    portENTER_CRITICAL(&_asyncsmp_stack_lock);
+    asyncsmp_stack_profile_t *profile = _asyncsmp_stack_profile(fn, true);
+    if (profile)
+    {
+        profile->stacksize = stacksize;
+        if (used > profile->peak)
+            profile->peak = used;
+        profile->runs++;
+    }
+    portEXIT_CRITICAL(&_asyncsmp_stack_lock);
+}
+#endif
+
+/**
+ * @brief Internal stack sizing
+ *
+ * Resolves ASYNCSMP_STACK_AUTO to the profiled peak of the function plus a margin.
+ */
+static uint32_t _asyncsmp_stack_size(asyncsmp_fn_t fn, uint32_t stacksize)
+{
+    if (stacksize != ASYNCSMP_STACK_AUTO)
+        return stacksize;
+    stacksize = CONFIG_ASYNCSMP_STACK_AUTO_DEFAULT;
+#if CONFIG_ASYNCSMP_STACK_PROFILE
+    portENTER_CRITICAL(&_asyncsmp_stack_lock);
+    asyncsmp_stack_profile_t *profile = _asyncsmp_stack_profile(fn, false);
+    if (profile)
+        stacksize = profile->peak + CONFIG_ASYNCSMP_STACK_AUTO_MARGIN;
+    portEXIT_CRITICAL(&_asyncsmp_stack_lock);
+#endif
+    return stacksize;
+}
+
+size_t asyncsmp_stack_report(asyncsmp_stack_profile_t *profiles, size_t len, uint32_t margin)
+{
+    size_t count = 0;
+#if CONFIG_ASYNCSMP_STACK_PROFILE
+    portENTER_CRITICAL(&_asyncsmp_stack_lock);
+    for (size_t i = 0; i < CONFIG_ASYNCSMP_STACK_PROFILE_SIZE && count < len; i++)
+    {
+        asyncsmp_stack_profile_t *profile = &_asyncsmp_stack_profiles[i];
+        if (!profile->fn)
+            continue;
+        uint32_t needed = profile->peak + margin;
+        if (profile->stacksize < needed || profile->stacksize > 2 * needed)
+            profiles[count++] = *profile;
+    }
+    portEXIT_CRITICAL(&_asyncsmp_stack_lock);
+#endif
+    return count;
+}
+
+static uint32_t _asyncsmp_prio_services;
+static uint32_t _asyncsmp_prio_boosts;
+
+UBaseType_t asyncsmp_prio_get(asyncsmp_req_t *req)
+{
+    UBaseType_t prio = 0;
+    for (; req; req = req->parent)
+    {
+        if (req->prio > prio)
+            prio = req->prio;
+    }
+    return prio;
+}
+
+/**
+ * @brief Internal priority inheritance
+ *
+ * Returns the priority a request should be serviced at, starting from the servicing task priority.
+ */
+static UBaseType_t _asyncsmp_prio_inherit(asyncsmp_req_t *req, UBaseType_t prio)
+{
+#if CONFIG_ASYNCSMP_PRIO_INHERIT
+    if (!req)
+        return prio;
+    __atomic_fetch_add(&_asyncsmp_prio_services, 1, __ATOMIC_RELAXED);
+    UBaseType_t inherited = asyncsmp_prio_get(req);
+    if (inherited <= prio)
+        return prio;
+    __atomic_fetch_add(&_asyncsmp_prio_boosts, 1, __ATOMIC_RELAXED);
+    return inherited;
+#else
+    return prio;
+#endif
+}
+
+UBaseType_t asyncsmp_prio_boost(asyncsmp_req_t *req)
+{
+    UBaseType_t prio = uxTaskPriorityGet(NULL);
+    UBaseType_t boosted = _asyncsmp_prio_inherit(req, prio);
+    if (boosted != prio)
+        vTaskPrioritySet(NULL, boosted);
+    return prio;
+}
+
+void asyncsmp_prio_restore(UBaseType_t prio)
+{
+    if (uxTaskPriorityGet(NULL) != prio)
+        vTaskPrioritySet(NULL, prio);
+}
+
+void asyncsmp_prio_stats(asyncsmp_prio_stats_t *stats)
+{
+    stats->services = __atomic_load_n(&_asyncsmp_prio_services, __ATOMIC_RELAXED);
+    stats->boosts = __atomic_load_n(&_asyncsmp_prio_boosts, __ATOMIC_RELAXED);
+}
+
 bool asyncsmp_exec(asyncsmp_fn_t fn, asyncsmp_req_t *req, uint32_t stacksize, uint32_t priority)
 {
-    _asyncsmp_exec_args_t *args = malloc(sizeof(_asyncsmp_exec_args_t));
+    return asyncsmp_exec_affinity(fn, req, stacksize, priority, ASYNCSMP_AFFINITY_ANY);
+}
+
+bool asyncsmp_exec_affinity(asyncsmp_fn_t fn, asyncsmp_req_t *req, uint32_t stacksize, uint32_t priority, asyncsmp_affinity_t affinity)
+{
+    return _asyncsmp_exec(fn, req, stacksize, priority, affinity, NULL, NULL);
+}
+
+bool _asyncsmp_exec(asyncsmp_fn_t fn, asyncsmp_req_t *req, uint32_t stacksize, uint32_t priority, asyncsmp_affinity_t affinity, void (*done)(void *ctx), void *ctx)
+{
+    BaseType_t core;
+    switch (affinity)
+    {
+    case ASYNCSMP_AFFINITY_ANY:
+        core = tskNO_AFFINITY;
+        break;
+    case ASYNCSMP_AFFINITY_SAME:
+        core = xPortGetCoreID();
+        break;
+    case ASYNCSMP_AFFINITY_OTHER:
+        core = (xPortGetCoreID() + 1) % portNUM_PROCESSORS;
+        break;
+    case ASYNCSMP_AFFINITY_FOLLOW:
+        if (!req)
+            core = tskNO_AFFINITY;
+        else if (req->parent)
+            core = req->parent->core;
+        else
+            core = req->core;
+        break;
+    default:
+        if (affinity < 0 || affinity >= portNUM_PROCESSORS)
+            return false;
+        core = affinity;
+    }
+    if (req)
+        asyncsmp_req_reset(req);
+
+    const asyncsmp_allocator_t *allocator = _asyncsmp_get_allocator(NULL);
+    _asyncsmp_exec_args_t *args = allocator->alloc(ASYNCSMP_MEM_CB_ARGS, sizeof(_asyncsmp_exec_args_t), allocator->ctx);
     if (!args)
         return false;
+    args->allocator = allocator;
     args->fn = fn;
     args->req = req;
-    if (xTaskCreate(
+    args->stacksize = _asyncsmp_stack_size(fn, stacksize);
+    priority = _asyncsmp_prio_inherit(req, priority);
+    args->done = done;
+    args->ctx = ctx;
+    if (xTaskCreatePinnedToCore(
             _asyncsmp_exec_task,
             "asyncsmp_exec_task",
-            stacksize,
+            args->stacksize,
             args,
             priority,
-            NULL) != pdTRUE)
+            NULL,
+            core) != pdTRUE)
     {
-        free(args);
+        _asyncsmp_mem_free(allocator, ASYNCSMP_MEM_CB_ARGS, args);
         return false;
     }
     return true;
@@ -277,7 +1270,9 @@ bool asyncsmp_exec(asyncsmp_fn_t fn, asyncsmp_req_t *req, uint32_t stacksize, ui
  */
 static void _asyncsmp_cb_sem(asyncsmp_req_t *req)
 {
-    xSemaphoreGive((SemaphoreHandle_t)req->cb_args);
+    // The semaphore is published before the awaiter flags itself as blocked, and stays until given
+    if (_asyncsmp_req_signal(req) & ASYNCSMP_STATE_BLOCKED)
+        xSemaphoreGive((SemaphoreHandle_t)req->cb_args);
 }
 
 /**
@@ -285,7 +1280,9 @@ static void _asyncsmp_cb_sem(asyncsmp_req_t *req)
  */
 static void _asyncsmp_cb_tn(asyncsmp_req_t *req)
 {
-    xTaskNotifyGive((TaskHandle_t)req->cb_args);
+    TaskHandle_t task = (TaskHandle_t)req->cb_args;
+    _asyncsmp_req_signal(req);
+    xTaskNotifyGive(task);
 }
 
 /**
@@ -293,17 +1290,19 @@ static void _asyncsmp_cb_tn(asyncsmp_req_t *req)
  */
 static void _asyncsmp_cb_qmsg(asyncsmp_req_t *req)
 {
+    asyncsmp_qmsg_args_t args = *(asyncsmp_qmsg_args_t *)req->cb_args;
     asyncsmp_msg_t msg = {
-        .type = ((asyncsmp_qmsg_args_t *)req->cb_args)->type,
+        .type = args.type,
         .data = (void *)req};
-    if (((asyncsmp_qmsg_args_t *)req->cb_args)->queue_guard)
+    _asyncsmp_req_signal(req);
+    if (args.queue_guard)
     {
-        xSemaphoreTake(((asyncsmp_qmsg_args_t *)req->cb_args)->queue_guard,portMAX_DELAY);
-        xQueueSendToBack(((asyncsmp_qmsg_args_t *)req->cb_args)->queue, &msg, portMAX_DELAY);
-        xSemaphoreGive(((asyncsmp_qmsg_args_t *)req->cb_args)->queue_guard);
+        xSemaphoreTake(args.queue_guard, portMAX_DELAY);
+        xQueueSendToBack(args.queue, &msg, portMAX_DELAY);
+        xSemaphoreGive(args.queue_guard);
         return;
     }
-    xQueueSendToBack(((asyncsmp_qmsg_args_t *)req->cb_args)->queue, &msg, portMAX_DELAY);
+    xQueueSendToBack(args.queue, &msg, portMAX_DELAY);
 }
 
 /**
@@ -311,7 +1310,26 @@ static void _asyncsmp_cb_qmsg(asyncsmp_req_t *req)
  */
 static void _asyncsmp_cb_eg(asyncsmp_req_t *req)
 {
-    xEventGroupSetBits((EventGroupHandle_t)((asyncsmp_eg_args_t *)req->cb_args)->eg, ((asyncsmp_eg_args_t *)req->cb_args)->eb);
+    asyncsmp_eg_args_t args = *(asyncsmp_eg_args_t *)req->cb_args;
+    _asyncsmp_req_signal(req);
+    xEventGroupSetBits(args.eg, args.eb);
+}
+
+/**
+ * @brief Internal stream request callback function
+ *
+ * Marks the end of the stream. The reader may free the request as soon as it sees it,
+ * unless it is waiting, in which case it is woken up first.
+ */
+static void _asyncsmp_cb_stream(asyncsmp_req_t *req)
+{
+    asyncsmp_stream_args_t *stream = (asyncsmp_stream_args_t *)req->cb_args;
+    SemaphoreHandle_t readable = stream->readable;
+    uint8_t flags = __atomic_load_n(&stream->flags, __ATOMIC_SEQ_CST);
+    while (!__atomic_compare_exchange_n(&stream->flags, &flags, (flags | ASYNCSMP_STREAM_ENDED) & ~ASYNCSMP_STREAM_READER, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+        ;
+    if (flags & ASYNCSMP_STREAM_READER)
+        xSemaphoreGive(readable);
 }
 
 /**
@@ -319,8 +1337,7 @@ static void _asyncsmp_cb_eg(asyncsmp_req_t *req)
  */
 static void _asyncsmp_cb_noawait(asyncsmp_req_t *req)
 {
-    free(req->data);
-    free(req);
+    _asyncsmp_req_free(req);
 }
 
 /**
@@ -328,7 +1345,15 @@ static void _asyncsmp_cb_noawait(asyncsmp_req_t *req)
  */
 static void _asyncsmp_exec_task(void *args)
 {
-    ((_asyncsmp_exec_args_t*)args)->fn(((_asyncsmp_exec_args_t*)args)->req);
-    free(args);
+    _asyncsmp_exec_args_t exec = *(_asyncsmp_exec_args_t *)args;
+    _asyncsmp_mem_free(exec.allocator, ASYNCSMP_MEM_CB_ARGS, args);
+    if (exec.req)
+        exec.req->core = xPortGetCoreID();
+    exec.fn(exec.req);
+#if CONFIG_ASYNCSMP_STACK_PROFILE
+    _asyncsmp_stack_record(exec.fn, exec.stacksize, exec.stacksize - uxTaskGetStackHighWaterMark(NULL));
+#endif
+    if (exec.done)
+        exec.done(exec.ctx);
     vTaskDelete(NULL);
 }
@@ -0,0 +1,180 @@
+/**
+ * Copyright 2021 Michele Riva
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#include <asyncsmp_bcast.h>
+#include "asyncsmp_priv.h"
+
+/**
+ * @brief Per-core subscriber lists
+ *
+ * Requests are added to the list of the subscribing core, so that subscribers on different cores
+ * do not contend for the same lock. Subscribed requests are linked through their bcast field.
+ */
+typedef struct _asyncsmp_bcast_list
+{
+    portMUX_TYPE lock;
+    asyncsmp_req_t *head;
+} _asyncsmp_bcast_list_t;
+
+struct asyncsmp_bcast
+{
+    _asyncsmp_bcast_list_t lists[portNUM_PROCESSORS];
+};
+
+/**
+ * @brief Payload header, keeping the payload 8-byte aligned
+ */
+typedef struct _asyncsmp_bcast_payload
+{
+    uint32_t refs;
+    uint32_t reserved;
+} _asyncsmp_bcast_payload_t;
+
+#define _asyncsmp_bcast_link(req) ((req)->bcast)
+#define _asyncsmp_bcast_header(payload) ((_asyncsmp_bcast_payload_t *)(payload)-1)
+
+asyncsmp_bcast_t *asyncsmp_bcast_create(void)
+{
+    asyncsmp_bcast_t *bcast = calloc(1, sizeof(asyncsmp_bcast_t));
+    if (!bcast)
+        return NULL;
+    for (size_t i = 0; i < portNUM_PROCESSORS; i++)
+        portMUX_INITIALIZE(&bcast->lists[i].lock);
+    return bcast;
+}
+
+void asyncsmp_bcast_delete(asyncsmp_bcast_t *bcast)
+{
+    free(bcast);
+}
+
+void asyncsmp_bcast_subscribe(asyncsmp_bcast_t *bcast, asyncsmp_req_t *req)
+{
+    _asyncsmp_bcast_list_t *list = &bcast->lists[xPortGetCoreID()];
+    asyncsmp_req_reset(req);
+    portENTER_CRITICAL(&list->lock);
+    _asyncsmp_bcast_link(req) = list->head;
+    list->head = req;
+    portEXIT_CRITICAL(&list->lock);
+}
+
+bool asyncsmp_bcast_unsubscribe(asyncsmp_bcast_t *bcast, asyncsmp_req_t *req)
+{
+    for (size_t i = 0; i < portNUM_PROCESSORS; i++)
+    {
+        _asyncsmp_bcast_list_t *list = &bcast->lists[i];
+        portENTER_CRITICAL(&list->lock);
+        for (asyncsmp_req_t **link = &list->head; *link; link = (asyncsmp_req_t **)&_asyncsmp_bcast_link(*link))
+        {
+            if (*link != req)
+                continue;
+            *link = _asyncsmp_bcast_link(req);
+            _asyncsmp_bcast_link(req) = NULL;
+            portEXIT_CRITICAL(&list->lock);
+            return true;
+        }
+        portEXIT_CRITICAL(&list->lock);
+    }
+    return false;
+}
+
+/**
+ * @brief Hand a payload reference to a subscriber and call it back
+ *
+ * No-await requests free themselves when called back, so nobody could release their reference.
+ */
+static void _asyncsmp_bcast_deliver(asyncsmp_req_t *req, void *payload, int8_t ret)
+{
+    if (_asyncsmp_req_noawait(req))
+    {
+        _asyncsmp_bcast_link(req) = NULL;
+        asyncsmp_cb(req, ret);
+        return;
+    }
+    asyncsmp_bcast_payload_retain(payload);
+    _asyncsmp_bcast_link(req) = payload;
+    asyncsmp_cb(req, ret);
+}
+
+size_t asyncsmp_bcast_cb(asyncsmp_bcast_t *bcast, void *payload, int8_t ret)
+{
+    size_t count = 0;
+    for (size_t i = 0; i < portNUM_PROCESSORS; i++)
+    {
+        _asyncsmp_bcast_list_t *list = &bcast->lists[i];
+        portENTER_CRITICAL(&list->lock);
+        asyncsmp_req_t *req = list->head;
+        list->head = NULL;
+        portEXIT_CRITICAL(&list->lock);
+        if (!req)
+            continue;
+
+        // Suspending the scheduler keeps the subscribers woken up on this core from preempting the producer
+        // one at a time, deferring callbacks which may block. Subscribers on other cores run as soon as woken up.
+        asyncsmp_req_t *deferred = NULL;
+        vTaskSuspendAll();
+        while (req)
+        {
+            asyncsmp_req_t *next = _asyncsmp_bcast_link(req);
+            if (_asyncsmp_req_batchable(req))
+            {
+                _asyncsmp_bcast_deliver(req, payload, ret);
+            }
+            else
+            {
+                _asyncsmp_bcast_link(req) = deferred;
+                deferred = req;
+            }
+            count++;
+            req = next;
+        }
+        xTaskResumeAll();
+
+        while (deferred)
+        {
+            asyncsmp_req_t *next = _asyncsmp_bcast_link(deferred);
+            _asyncsmp_bcast_deliver(deferred, payload, ret);
+            deferred = next;
+        }
+    }
+    asyncsmp_bcast_payload_release(payload);
+    return count;
+}
+
+void *asyncsmp_bcast_payload_alloc(size_t size)
+{
+    _asyncsmp_bcast_payload_t *header = calloc(1, sizeof(_asyncsmp_bcast_payload_t) + size);
+    if (!header)
+        return NULL;
+    header->refs = 1;
+    return header + 1;
+}
+
+void *asyncsmp_bcast_payload(asyncsmp_req_t *req)
+{
+    return _asyncsmp_bcast_link(req);
+}
+
+void asyncsmp_bcast_payload_retain(void *payload)
+{
+    if (payload)
+        __atomic_fetch_add(&_asyncsmp_bcast_header(payload)->refs, 1, __ATOMIC_RELAXED);
+}
+
+void asyncsmp_bcast_payload_release(void *payload)
+{
+    if (payload && __atomic_sub_fetch(&_asyncsmp_bcast_header(payload)->refs, 1, __ATOMIC_ACQ_REL) == 0)
+        free(_asyncsmp_bcast_header(payload));
+}
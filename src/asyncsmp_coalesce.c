@@ -0,0 +1,327 @@
+/**
+ * Copyright 2021 Michele Riva
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#include <asyncsmp_coalesce.h>
+
+#define ASYNCSMP_COALESCE_BUCKETS 16
+#define ASYNCSMP_COALESCE_CACHED_MAX 64
+
+typedef struct _asyncsmp_coalesce_waiter
+{
+    struct _asyncsmp_coalesce_waiter *next;
+    asyncsmp_req_t *req;
+} _asyncsmp_coalesce_waiter_t;
+
+/**
+ * @brief Cached result
+ *
+ * Results are immutable once cached, and reference counted so that they are copied out of the lock.
+ */
+typedef struct _asyncsmp_coalesce_result
+{
+    uint32_t refs;
+    int8_t ret;
+    uint8_t data[];
+} _asyncsmp_coalesce_result_t;
+
+typedef struct _asyncsmp_coalesce_entry
+{
+    struct _asyncsmp_coalesce_entry *next;
+    asyncsmp_enum_t type;
+    uint32_t key;
+    asyncsmp_req_t *req;
+    _asyncsmp_coalesce_waiter_t *waiters;
+    _asyncsmp_coalesce_result_t *result;
+    TickType_t cached;
+} _asyncsmp_coalesce_entry_t;
+
+struct asyncsmp_coalesce
+{
+    portMUX_TYPE lock;
+    size_t data_size;
+    TickType_t ttl;
+    size_t cached;
+    size_t sweep;
+    _asyncsmp_coalesce_entry_t *buckets[ASYNCSMP_COALESCE_BUCKETS];
+};
+
+static void _asyncsmp_coalesce_result_release(_asyncsmp_coalesce_result_t *result)
+{
+    if (result && __atomic_sub_fetch(&result->refs, 1, __ATOMIC_ACQ_REL) == 0)
+        free(result);
+}
+
+/**
+ * @brief Copy the request data of a result into a request
+ *
+ * Requests allocated without data are left untouched.
+ */
+static void _asyncsmp_coalesce_copy(asyncsmp_coalesce_t *coalesce, asyncsmp_req_t *req, const void *data)
+{
+    if (coalesce->data_size && req->data && data)
+        memcpy(req->data, data, coalesce->data_size);
+}
+
+asyncsmp_coalesce_t *asyncsmp_coalesce_create(size_t data_size, TickType_t ttl)
+{
+    asyncsmp_coalesce_t *coalesce = calloc(1, sizeof(asyncsmp_coalesce_t));
+    if (!coalesce)
+        return NULL;
+    portMUX_INITIALIZE(&coalesce->lock);
+    coalesce->data_size = data_size;
+    coalesce->ttl = ttl;
+    return coalesce;
+}
+
+void asyncsmp_coalesce_delete(asyncsmp_coalesce_t *coalesce)
+{
+    if (!coalesce)
+        return;
+    for (size_t i = 0; i < ASYNCSMP_COALESCE_BUCKETS; i++)
+    {
+        _asyncsmp_coalesce_entry_t *entry = coalesce->buckets[i];
+        while (entry)
+        {
+            _asyncsmp_coalesce_entry_t *next = entry->next;
+            _asyncsmp_coalesce_waiter_t *waiter = entry->waiters;
+            while (waiter)
+            {
+                _asyncsmp_coalesce_waiter_t *next_waiter = waiter->next;
+                free(waiter);
+                waiter = next_waiter;
+            }
+            _asyncsmp_coalesce_result_release(entry->result);
+            free(entry);
+            entry = next;
+        }
+    }
+    free(coalesce);
+}
+
+/**
+ * @brief Bucket of a message type and key
+ */
+static _asyncsmp_coalesce_entry_t **_asyncsmp_coalesce_bucket(asyncsmp_coalesce_t *coalesce, asyncsmp_enum_t msg_type, uint32_t key)
+{
+    uint32_t hash = (key ^ (msg_type * 0x9E3779B1u)) * 0x85EBCA6Bu;
+    return &coalesce->buckets[(hash >> 16) % ASYNCSMP_COALESCE_BUCKETS];
+}
+
+/**
+ * @brief Whether an entry is a cached result which expired (lock held)
+ */
+static bool _asyncsmp_coalesce_expired(asyncsmp_coalesce_t *coalesce, _asyncsmp_coalesce_entry_t *entry, TickType_t now)
+{
+    return !entry->req && now - entry->cached >= coalesce->ttl;
+}
+
+/**
+ * @brief Unlink an expired entry into a list to be freed outside of the lock (lock held)
+ */
+static void _asyncsmp_coalesce_unlink(asyncsmp_coalesce_t *coalesce, _asyncsmp_coalesce_entry_t **link, _asyncsmp_coalesce_entry_t **expired)
+{
+    _asyncsmp_coalesce_entry_t *entry = *link;
+    *link = entry->next;
+    entry->next = *expired;
+    *expired = entry;
+    coalesce->cached--;
+}
+
+/**
+ * @brief Find entry in bucket (lock held)
+ *
+ * Cached results which expired on the way are unlinked and collected in a list to be freed outside of the lock.
+ */
+static _asyncsmp_coalesce_entry_t *_asyncsmp_coalesce_find(asyncsmp_coalesce_t *coalesce, _asyncsmp_coalesce_entry_t **bucket, asyncsmp_enum_t msg_type, uint32_t key, _asyncsmp_coalesce_entry_t **expired)
+{
+    TickType_t now = xTaskGetTickCount();
+    _asyncsmp_coalesce_entry_t **link = bucket;
+    while (*link)
+    {
+        _asyncsmp_coalesce_entry_t *entry = *link;
+        if (_asyncsmp_coalesce_expired(coalesce, entry, now))
+        {
+            _asyncsmp_coalesce_unlink(coalesce, link, expired);
+            continue;
+        }
+        if (entry->type == msg_type && entry->key == key)
+            return entry;
+        link = &entry->next;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Purge expired results from the next bucket in turn (lock held)
+ *
+ * Called on every insertion, so that results of keys which are never looked up again do not pile up.
+ */
+static void _asyncsmp_coalesce_sweep(asyncsmp_coalesce_t *coalesce, _asyncsmp_coalesce_entry_t **expired)
+{
+    if (!coalesce->cached)
+        return;
+    TickType_t now = xTaskGetTickCount();
+    _asyncsmp_coalesce_entry_t **link = &coalesce->buckets[coalesce->sweep++ % ASYNCSMP_COALESCE_BUCKETS];
+    while (*link)
+    {
+        if (_asyncsmp_coalesce_expired(coalesce, *link, now))
+            _asyncsmp_coalesce_unlink(coalesce, link, expired);
+        else
+            link = &(*link)->next;
+    }
+}
+
+bool asyncsmp_coalesce_join(asyncsmp_coalesce_t *coalesce, asyncsmp_enum_t msg_type, uint32_t key, asyncsmp_req_t *req)
+{
+    _asyncsmp_coalesce_entry_t **bucket = _asyncsmp_coalesce_bucket(coalesce, msg_type, key);
+    _asyncsmp_coalesce_entry_t *expired = NULL;
+    _asyncsmp_coalesce_entry_t *spare = NULL;
+    _asyncsmp_coalesce_waiter_t *waiter = NULL;
+    _asyncsmp_coalesce_result_t *result = NULL;
+    bool serve = true;
+    asyncsmp_req_reset(req);
+
+    // Memory is allocated outside of the lock, so the lookup is retried after allocating
+    while (true)
+    {
+        portENTER_CRITICAL(&coalesce->lock);
+        _asyncsmp_coalesce_entry_t *entry = _asyncsmp_coalesce_find(coalesce, bucket, msg_type, key, &expired);
+        if (entry && entry->req)
+        {
+            if (waiter)
+            {
+                waiter->req = req;
+                waiter->next = entry->waiters;
+                entry->waiters = waiter;
+                waiter = NULL;
+                serve = false;
+                portEXIT_CRITICAL(&coalesce->lock);
+                break;
+            }
+            portEXIT_CRITICAL(&coalesce->lock);
+            waiter = malloc(sizeof(_asyncsmp_coalesce_waiter_t));
+            if (!waiter)
+                break;
+            continue;
+        }
+        if (entry)
+        {
+            // The result is copied once out of the lock
+            result = entry->result;
+            __atomic_fetch_add(&result->refs, 1, __ATOMIC_RELAXED);
+            serve = false;
+            portEXIT_CRITICAL(&coalesce->lock);
+            break;
+        }
+        if (spare)
+        {
+            spare->type = msg_type;
+            spare->key = key;
+            spare->req = req;
+            spare->waiters = NULL;
+            spare->result = NULL;
+            spare->next = *bucket;
+            *bucket = spare;
+            spare = NULL;
+            _asyncsmp_coalesce_sweep(coalesce, &expired);
+            portEXIT_CRITICAL(&coalesce->lock);
+            break;
+        }
+        portEXIT_CRITICAL(&coalesce->lock);
+        spare = malloc(sizeof(_asyncsmp_coalesce_entry_t));
+        if (!spare)
+            break;
+    }
+
+    free(spare);
+    free(waiter);
+    while (expired)
+    {
+        _asyncsmp_coalesce_entry_t *next = expired->next;
+        _asyncsmp_coalesce_result_release(expired->result);
+        free(expired);
+        expired = next;
+    }
+    if (result)
+    {
+        _asyncsmp_coalesce_copy(coalesce, req, result->data);
+        int8_t ret = result->ret;
+        _asyncsmp_coalesce_result_release(result);
+        asyncsmp_cb(req, ret);
+    }
+    return serve;
+}
+
+void asyncsmp_coalesce_cb(asyncsmp_coalesce_t *coalesce, asyncsmp_enum_t msg_type, uint32_t key, asyncsmp_req_t *req, int8_t ret)
+{
+    _asyncsmp_coalesce_entry_t **bucket = _asyncsmp_coalesce_bucket(coalesce, msg_type, key);
+    _asyncsmp_coalesce_entry_t *entry = NULL;
+    _asyncsmp_coalesce_waiter_t *waiters = NULL;
+    _asyncsmp_coalesce_result_t *result = NULL;
+
+    // The result to cache is prepared out of the lock, and dropped if not needed
+    if (coalesce->ttl)
+    {
+        result = malloc(sizeof(_asyncsmp_coalesce_result_t) + coalesce->data_size);
+        if (result)
+        {
+            result->refs = 1;
+            result->ret = ret;
+            if (coalesce->data_size)
+            {
+                if (req->data)
+                    memcpy(result->data, req->data, coalesce->data_size);
+                else
+                    memset(result->data, 0, coalesce->data_size);
+            }
+        }
+    }
+
+    portENTER_CRITICAL(&coalesce->lock);
+    for (_asyncsmp_coalesce_entry_t **link = bucket; *link; link = &(*link)->next)
+    {
+        if ((*link)->req != req)
+            continue;
+        waiters = (*link)->waiters;
+        if (result && coalesce->cached < ASYNCSMP_COALESCE_CACHED_MAX)
+        {
+            (*link)->req = NULL;
+            (*link)->waiters = NULL;
+            (*link)->result = result;
+            (*link)->cached = xTaskGetTickCount();
+            coalesce->cached++;
+            result = NULL;
+        }
+        else
+        {
+            entry = *link;
+            *link = entry->next;
+        }
+        break;
+    }
+    portEXIT_CRITICAL(&coalesce->lock);
+
+    while (waiters)
+    {
+        _asyncsmp_coalesce_waiter_t *next = waiters->next;
+        _asyncsmp_coalesce_copy(coalesce, waiters->req, req->data);
+        asyncsmp_cb(waiters->req, ret);
+        free(waiters);
+        waiters = next;
+    }
+    _asyncsmp_coalesce_result_release(result);
+    free(entry);
+    asyncsmp_cb(req, ret);
+}
@@ -0,0 +1,332 @@
+/**
+ * Copyright 2021 Michele Riva
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#include <asyncsmp_hedge.h>
+#include <asyncsmp_timer.h>
+#include "asyncsmp_priv.h"
+
+/**
+ * @brief Latency histogram geometry
+ *
+ * One bucket per tick up to ASYNCSMP_HEDGE_LINEAR ticks, then one per power of two.
+ * Counts are halved whenever they reach ASYNCSMP_HEDGE_WINDOW samples, so that old latencies fade away.
+ */
+#define ASYNCSMP_HEDGE_LINEAR 32
+#define ASYNCSMP_HEDGE_BUCKETS (ASYNCSMP_HEDGE_LINEAR + 27)
+#define ASYNCSMP_HEDGE_WINDOW 1024
+#define ASYNCSMP_HEDGE_WARMUP 32  // Samples observed before hedging starts
+#define ASYNCSMP_HEDGE_REFRESH 16 // Samples between updates of the hedging delay
+
+struct asyncsmp_hedge
+{
+    portMUX_TYPE lock;
+    asyncsmp_enum_t msg_type;
+    size_t data_size;
+    uint8_t percentile;
+    TickType_t min_delay;
+    TickType_t delay;
+    uint32_t next;
+    uint32_t total;
+    uint32_t fresh;
+    uint32_t histogram[ASYNCSMP_HEDGE_BUCKETS];
+    uint32_t requests;
+    uint32_t hedged;
+    uint32_t wins;
+    uint32_t discarded;
+    size_t n;
+    QueueHandle_t receivers[];
+};
+
+/**
+ * @brief Hedged call
+ *
+ * Shared by the copies of a request and the timer sending the duplicate. Each of them holds
+ * a reference, and the last one released frees everything. The original request data is kept
+ * here, as the request may be freed by its owner while a late duplicate is being sent.
+ */
+typedef struct _asyncsmp_hedge_call
+{
+    asyncsmp_hedge_t *hedge;
+    asyncsmp_req_t *req;
+    asyncsmp_req_t *copies[2];
+    asyncsmp_req_t *timer;
+    TickType_t sent[2];
+    uint32_t receiver;
+    uint32_t refs;
+    UBaseType_t prio;
+    bool done;
+    uint8_t data[];
+} _asyncsmp_hedge_call_t;
+
+static void _asyncsmp_hedge_cb_copy(asyncsmp_req_t *copy);
+static void _asyncsmp_hedge_cb_timer(asyncsmp_req_t *timer);
+
+asyncsmp_hedge_t *asyncsmp_hedge_create(const QueueHandle_t *receivers, size_t n, asyncsmp_enum_t msg_type, size_t data_size, uint8_t percentile, TickType_t min_delay)
+{
+    if (!n)
+        return NULL;
+    asyncsmp_hedge_t *hedge = calloc(1, sizeof(asyncsmp_hedge_t) + n * sizeof(QueueHandle_t));
+    if (!hedge)
+        return NULL;
+    portMUX_INITIALIZE(&hedge->lock);
+    hedge->msg_type = msg_type;
+    hedge->data_size = data_size;
+    hedge->percentile = percentile > 100 ? 100 : percentile;
+    hedge->min_delay = min_delay;
+    hedge->delay = portMAX_DELAY;
+    hedge->n = n;
+    memcpy(hedge->receivers, receivers, n * sizeof(QueueHandle_t));
+    return hedge;
+}
+
+void asyncsmp_hedge_delete(asyncsmp_hedge_t *hedge)
+{
+    free(hedge);
+}
+
+static size_t _asyncsmp_hedge_bucket(TickType_t ticks)
+{
+    if (ticks < ASYNCSMP_HEDGE_LINEAR)
+        return ticks;
+    return ASYNCSMP_HEDGE_LINEAR - 5 + (31 - __builtin_clz(ticks));
+}
+
+static TickType_t _asyncsmp_hedge_bucket_max(size_t bucket)
+{
+    if (bucket < ASYNCSMP_HEDGE_LINEAR)
+        return bucket;
+    return ((TickType_t)2 << (bucket - ASYNCSMP_HEDGE_LINEAR + 5)) - 1;
+}
+
+/**
+ * @brief Latency percentile (lock held)
+ *
+ * Buckets are not interpolated, the upper bound of the bucket reaching the percentile is returned.
+ */
+static TickType_t _asyncsmp_hedge_percentile(asyncsmp_hedge_t *hedge, uint8_t percentile)
+{
+    if (!hedge->total)
+        return portMAX_DELAY;
+    uint32_t rank = ((uint64_t)hedge->total * percentile + 99) / 100;
+    uint32_t seen = 0;
+    for (size_t i = 0; i < ASYNCSMP_HEDGE_BUCKETS; i++)
+    {
+        seen += hedge->histogram[i];
+        if (seen >= rank && seen)
+            return _asyncsmp_hedge_bucket_max(i);
+    }
+    return _asyncsmp_hedge_bucket_max(ASYNCSMP_HEDGE_BUCKETS - 1);
+}
+
+/**
+ * @brief Record the latency of an answered copy, and periodically update the hedging delay
+ */
+static void _asyncsmp_hedge_record(asyncsmp_hedge_t *hedge, TickType_t latency)
+{
+    portENTER_CRITICAL(&hedge->lock);
+    hedge->histogram[_asyncsmp_hedge_bucket(latency)]++;
+    if (++hedge->total >= ASYNCSMP_HEDGE_WINDOW)
+    {
+        hedge->total = 0;
+        for (size_t i = 0; i < ASYNCSMP_HEDGE_BUCKETS; i++)
+        {
+            hedge->histogram[i] >>= 1;
+            hedge->total += hedge->histogram[i];
+        }
+    }
+    if (++hedge->fresh >= ASYNCSMP_HEDGE_REFRESH && hedge->total >= ASYNCSMP_HEDGE_WARMUP)
+    {
+        TickType_t delay = _asyncsmp_hedge_percentile(hedge, hedge->percentile);
+        __atomic_store_n(&hedge->delay, delay > hedge->min_delay ? delay : hedge->min_delay, __ATOMIC_RELAXED);
+        hedge->fresh = 0;
+    }
+    portEXIT_CRITICAL(&hedge->lock);
+}
+
+/**
+ * @brief Allocate a copy of the request carried by a call
+ */
+static asyncsmp_req_t *_asyncsmp_hedge_copy(_asyncsmp_hedge_call_t *call)
+{
+    asyncsmp_req_t *copy = asyncsmp_req_alloc_custom(_asyncsmp_hedge_cb_copy, call, call->hedge->data_size);
+    if (!copy)
+        return NULL;
+    if (call->hedge->data_size)
+        memcpy(copy->data, call->data, call->hedge->data_size);
+    // Copies are not chained to the request, which may be gone before they are answered
+    copy->prio = call->prio;
+    return copy;
+}
+
+static bool _asyncsmp_hedge_post(asyncsmp_hedge_t *hedge, uint32_t receiver, asyncsmp_req_t *copy)
+{
+    asyncsmp_msg_t msg = {
+        .type = hedge->msg_type,
+        .data = (void *)copy};
+    return xQueueSendToBack(hedge->receivers[receiver % hedge->n], &msg, 0) == pdTRUE;
+}
+
+static void _asyncsmp_hedge_release(_asyncsmp_hedge_call_t *call)
+{
+    if (__atomic_sub_fetch(&call->refs, 1, __ATOMIC_SEQ_CST))
+        return;
+    asyncsmp_req_free_custom(call->copies[0]);
+    asyncsmp_req_free_custom(call->copies[1]);
+    asyncsmp_req_free_custom(call->timer);
+    free(call);
+}
+
+/**
+ * @brief Copy callback
+ *
+ * The first copy answered calls back the request, cancels the other copy and the pending duplicate.
+ * Later answers only release their reference.
+ */
+static void _asyncsmp_hedge_cb_copy(asyncsmp_req_t *copy)
+{
+    _asyncsmp_hedge_call_t *call = copy->cb_args;
+    asyncsmp_hedge_t *hedge = call->hedge;
+    size_t index = copy == call->copies[0] ? 0 : 1;
+
+    _asyncsmp_hedge_record(hedge, xTaskGetTickCount() - call->sent[index]);
+    if (__atomic_exchange_n(&call->done, true, __ATOMIC_SEQ_CST))
+    {
+        __atomic_fetch_add(&hedge->discarded, 1, __ATOMIC_RELAXED);
+        _asyncsmp_hedge_release(call);
+        return;
+    }
+
+    asyncsmp_req_t *other = __atomic_load_n(&call->copies[!index], __ATOMIC_SEQ_CST);
+    if (other)
+        __atomic_fetch_or(&other->state, ASYNCSMP_STATE_CANCELLED, __ATOMIC_SEQ_CST);
+    if (call->timer && asyncsmp_timer_cancel(call->timer))
+        _asyncsmp_hedge_release(call);
+    if (index)
+        __atomic_fetch_add(&hedge->wins, 1, __ATOMIC_RELAXED);
+    if (hedge->data_size)
+        memcpy(call->req->data, copy->data, hedge->data_size);
+    asyncsmp_cb(call->req, copy->ret);
+    _asyncsmp_hedge_release(call);
+}
+
+/**
+ * @brief Timer callback, sending the duplicate unless the request was answered meanwhile
+ *
+ * The timer reference is handed over to the duplicate once sent. The call is checked again
+ * after publishing the duplicate, so that either the winner cancels it or it is never sent.
+ */
+static void _asyncsmp_hedge_cb_timer(asyncsmp_req_t *timer)
+{
+    _asyncsmp_hedge_call_t *call = timer->cb_args;
+    asyncsmp_hedge_t *hedge = call->hedge;
+
+    if (!__atomic_load_n(&call->done, __ATOMIC_SEQ_CST))
+    {
+        asyncsmp_req_t *copy = _asyncsmp_hedge_copy(call);
+        if (copy)
+        {
+            call->sent[1] = xTaskGetTickCount();
+            __atomic_store_n(&call->copies[1], copy, __ATOMIC_SEQ_CST);
+            uint32_t receiver = __atomic_load_n(&call->receiver, __ATOMIC_SEQ_CST) + 1;
+            if (!__atomic_load_n(&call->done, __ATOMIC_SEQ_CST) && _asyncsmp_hedge_post(hedge, receiver, copy))
+            {
+                __atomic_fetch_add(&hedge->hedged, 1, __ATOMIC_RELAXED);
+                return;
+            }
+        }
+    }
+    _asyncsmp_hedge_release(call);
+}
+
+bool asyncsmp_hedge_send(asyncsmp_hedge_t *hedge, asyncsmp_req_t *req)
+{
+    _asyncsmp_hedge_call_t *call = calloc(1, sizeof(_asyncsmp_hedge_call_t) + hedge->data_size);
+    if (!call)
+        return false;
+    asyncsmp_req_reset(req);
+    call->hedge = hedge;
+    call->req = req;
+    // The first copy and the sender hold a reference, the sender's one until it is done with the call
+    call->refs = 2;
+    call->prio = asyncsmp_prio_get(req);
+    if (hedge->data_size)
+        memcpy(call->data, req->data, hedge->data_size);
+    call->copies[0] = _asyncsmp_hedge_copy(call);
+    if (!call->copies[0])
+    {
+        free(call);
+        return false;
+    }
+
+    // The duplicate timer holds its reference from the start, so that the call outlives an early answer
+    TickType_t delay = __atomic_load_n(&hedge->delay, __ATOMIC_RELAXED);
+    asyncsmp_req_t *timer = NULL;
+    if (hedge->n > 1 && delay != portMAX_DELAY)
+    {
+        timer = asyncsmp_req_alloc_custom(_asyncsmp_hedge_cb_timer, call, 0);
+        if (timer)
+            call->refs++;
+        call->timer = timer;
+    }
+
+    // Receivers are tried in turn, starting from the next one, until one has room
+    uint32_t first = __atomic_fetch_add(&hedge->next, 1, __ATOMIC_RELAXED);
+    bool posted = false;
+    call->sent[0] = xTaskGetTickCount();
+    for (size_t i = 0; i < hedge->n && !posted; i++)
+    {
+        __atomic_store_n(&call->receiver, first + i, __ATOMIC_SEQ_CST);
+        posted = _asyncsmp_hedge_post(hedge, first + i, call->copies[0]);
+    }
+    if (!posted)
+    {
+        // Nobody took the request, nothing else refers to the call
+        if (timer)
+            _asyncsmp_hedge_release(call);
+        _asyncsmp_hedge_release(call);
+        _asyncsmp_hedge_release(call);
+        return false;
+    }
+    __atomic_fetch_add(&hedge->requests, 1, __ATOMIC_RELAXED);
+
+    // The duplicate is armed only once the request is in flight, so that it is never sent for a request reported as not sent.
+    // An answer arriving before the timer is armed fails to cancel it, and the timer finds the call done when it fires.
+    if (timer && (__atomic_load_n(&call->done, __ATOMIC_SEQ_CST) || !asyncsmp_timer_cb_after(timer, 0, delay)))
+        _asyncsmp_hedge_release(call);
+    _asyncsmp_hedge_release(call);
+    return true;
+}
+
+bool asyncsmp_hedge_cancelled(asyncsmp_req_t *req)
+{
+    return __atomic_load_n(&req->state, __ATOMIC_SEQ_CST) & ASYNCSMP_STATE_CANCELLED;
+}
+
+TickType_t asyncsmp_hedge_latency(asyncsmp_hedge_t *hedge, uint8_t percentile)
+{
+    portENTER_CRITICAL(&hedge->lock);
+    TickType_t latency = _asyncsmp_hedge_percentile(hedge, percentile > 100 ? 100 : percentile);
+    portEXIT_CRITICAL(&hedge->lock);
+    return latency;
+}
+
+void asyncsmp_hedge_stats(asyncsmp_hedge_t *hedge, asyncsmp_hedge_stats_t *stats)
+{
+    stats->requests = __atomic_load_n(&hedge->requests, __ATOMIC_RELAXED);
+    stats->hedged = __atomic_load_n(&hedge->hedged, __ATOMIC_RELAXED);
+    stats->wins = __atomic_load_n(&hedge->wins, __ATOMIC_RELAXED);
+    stats->discarded = __atomic_load_n(&hedge->discarded, __ATOMIC_RELAXED);
+    stats->delay = __atomic_load_n(&hedge->delay, __ATOMIC_RELAXED);
+}
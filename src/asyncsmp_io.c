@@ -0,0 +1,246 @@
+/**
+ * Copyright 2021 Michele Riva
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#include <asyncsmp_io.h>
+#include <errno.h>
+#include <unistd.h>
+#if CONFIG_IDF_TARGET_LINUX
+#include <sys/uio.h>
+#endif
+
+#define ASYNCSMP_IO_BATCH 16       // Operations dequeued at once
+#define ASYNCSMP_IO_MERGE_MAX 4096 // Bytes merged through a bounce buffer, where vectored calls are unavailable
+
+struct asyncsmp_io
+{
+    QueueHandle_t queue;
+    SemaphoreHandle_t stopped;
+    uint32_t ops;
+    uint32_t batches;
+    uint32_t calls;
+};
+
+static inline asyncsmp_io_op_t *_asyncsmp_io_op(asyncsmp_req_t *req)
+{
+    return (asyncsmp_io_op_t *)req->data;
+}
+
+/**
+ * @brief Whether an operation can be merged at the end of a run
+ *
+ * Reads and writes merge when contiguous, stream writes when on the same stream, flushes when on the same file.
+ * Stream reads never merge, as they may return short.
+ */
+static bool _asyncsmp_io_mergeable(asyncsmp_io_op_t *last, asyncsmp_io_op_t *op, size_t run_len)
+{
+    if (op->type != last->type || op->fd != last->fd)
+        return false;
+    if (op->type == ASYNCSMP_IO_FLUSH)
+        return true;
+    if ((op->offset == ASYNCSMP_IO_STREAM) != (last->offset == ASYNCSMP_IO_STREAM))
+        return false;
+    if (op->offset == ASYNCSMP_IO_STREAM && op->type == ASYNCSMP_IO_READ)
+        return false;
+    if (op->offset != ASYNCSMP_IO_STREAM && op->offset != last->offset + (off_t)last->len)
+        return false;
+#if !CONFIG_IDF_TARGET_LINUX
+    if (run_len + op->len > ASYNCSMP_IO_MERGE_MAX)
+        return false;
+#endif
+    return true;
+}
+
+/**
+ * @brief Perform a run of merged operations with a single call
+ *
+ * @return Bytes transferred, or -errno
+ */
+static ssize_t _asyncsmp_io_perform(asyncsmp_req_t **reqs, size_t n, size_t len)
+{
+    asyncsmp_io_op_t *first = _asyncsmp_io_op(reqs[0]);
+    bool writing = first->type == ASYNCSMP_IO_WRITE;
+    bool stream = first->offset == ASYNCSMP_IO_STREAM;
+    ssize_t ret;
+
+    if (first->type == ASYNCSMP_IO_FLUSH)
+    {
+        ret = fsync(first->fd);
+    }
+    else if (n == 1)
+    {
+        if (writing)
+            ret = stream ? write(first->fd, first->buf, first->len) : pwrite(first->fd, first->buf, first->len, first->offset);
+        else
+            ret = stream ? read(first->fd, first->buf, first->len) : pread(first->fd, first->buf, first->len, first->offset);
+    }
+    else
+    {
+#if CONFIG_IDF_TARGET_LINUX
+        struct iovec iov[ASYNCSMP_IO_BATCH];
+        for (size_t i = 0; i < n; i++)
+        {
+            iov[i].iov_base = _asyncsmp_io_op(reqs[i])->buf;
+            iov[i].iov_len = _asyncsmp_io_op(reqs[i])->len;
+        }
+        if (writing)
+            ret = stream ? writev(first->fd, iov, n) : pwritev(first->fd, iov, n, first->offset);
+        else
+            ret = preadv(first->fd, iov, n, first->offset);
+#else
+        uint8_t *bounce = malloc(len);
+        if (!bounce)
+            return -ENOMEM;
+        if (writing)
+        {
+            size_t pos = 0;
+            for (size_t i = 0; i < n; i++)
+            {
+                memcpy(bounce + pos, _asyncsmp_io_op(reqs[i])->buf, _asyncsmp_io_op(reqs[i])->len);
+                pos += _asyncsmp_io_op(reqs[i])->len;
+            }
+            ret = stream ? write(first->fd, bounce, len) : pwrite(first->fd, bounce, len, first->offset);
+        }
+        else
+        {
+            ret = pread(first->fd, bounce, len, first->offset);
+            size_t pos = 0;
+            for (size_t i = 0; i < n && ret > 0 && pos < (size_t)ret; i++)
+            {
+                size_t chunk = _asyncsmp_io_op(reqs[i])->len;
+                if (chunk > (size_t)ret - pos)
+                    chunk = (size_t)ret - pos;
+                memcpy(_asyncsmp_io_op(reqs[i])->buf, bounce + pos, chunk);
+                pos += chunk;
+            }
+        }
+        free(bounce);
+#endif
+    }
+    return ret < 0 ? -errno : ret;
+}
+
+/**
+ * @brief Spread the result of a run over its operations, then call them back
+ */
+static void _asyncsmp_io_complete(asyncsmp_req_t **reqs, size_t n, ssize_t ret)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        asyncsmp_io_op_t *op = _asyncsmp_io_op(reqs[i]);
+        if (ret < 0 || op->type == ASYNCSMP_IO_FLUSH)
+        {
+            op->result = ret < 0 ? ret : 0;
+        }
+        else
+        {
+            op->result = (size_t)ret < op->len ? ret : (ssize_t)op->len;
+            ret -= op->result;
+        }
+        asyncsmp_cb(reqs[i], op->result < 0 ? -1 : 0);
+    }
+}
+
+static void _asyncsmp_io_task(void *args)
+{
+    asyncsmp_io_t *io = args;
+    asyncsmp_req_t *reqs[ASYNCSMP_IO_BATCH];
+    bool stop = false;
+
+    while (!stop)
+    {
+        // Dequeue whatever is queued, up to a batch (NULL requests stop the worker)
+        size_t n = 0;
+        xQueueReceive(io->queue, &reqs[n++], portMAX_DELAY);
+        while (n < ASYNCSMP_IO_BATCH && reqs[n - 1] && xQueueReceive(io->queue, &reqs[n], 0) == pdTRUE)
+            n++;
+        if (!reqs[n - 1])
+        {
+            stop = true;
+            n--;
+        }
+        if (!n)
+            continue;
+
+        // Serve the batch at the highest priority of its requests
+        UBaseType_t prio = uxTaskPriorityGet(NULL);
+        for (size_t i = 0; i < n; i++)
+            asyncsmp_prio_boost(reqs[i]);
+
+        for (size_t i = 0; i < n;)
+        {
+            size_t j = i + 1;
+            size_t len = _asyncsmp_io_op(reqs[i])->len;
+            while (j < n && _asyncsmp_io_mergeable(_asyncsmp_io_op(reqs[j - 1]), _asyncsmp_io_op(reqs[j]), len))
+                len += _asyncsmp_io_op(reqs[j++])->len;
+            ssize_t ret = _asyncsmp_io_perform(&reqs[i], j - i, len);
+            __atomic_fetch_add(&io->calls, 1, __ATOMIC_RELAXED);
+            _asyncsmp_io_complete(&reqs[i], j - i, ret);
+            i = j;
+        }
+
+        asyncsmp_prio_restore(prio);
+        __atomic_fetch_add(&io->ops, n, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&io->batches, 1, __ATOMIC_RELAXED);
+    }
+
+    xSemaphoreGive(io->stopped);
+    vTaskDelete(NULL);
+}
+
+asyncsmp_io_t *asyncsmp_io_create(size_t queue_len, uint32_t stacksize, UBaseType_t priority)
+{
+    asyncsmp_io_t *io = calloc(1, sizeof(asyncsmp_io_t));
+    if (!io)
+        return NULL;
+    io->queue = xQueueCreate(queue_len, sizeof(asyncsmp_req_t *));
+    io->stopped = xSemaphoreCreateBinary();
+    if (!io->queue || !io->stopped || xTaskCreate(_asyncsmp_io_task, "asyncsmp_io", stacksize, io, priority, NULL) != pdPASS)
+    {
+        if (io->queue)
+            vQueueDelete(io->queue);
+        if (io->stopped)
+            vSemaphoreDelete(io->stopped);
+        free(io);
+        return NULL;
+    }
+    return io;
+}
+
+void asyncsmp_io_delete(asyncsmp_io_t *io)
+{
+    if (!io)
+        return;
+    asyncsmp_req_t *stop = NULL;
+    xQueueSendToBack(io->queue, &stop, portMAX_DELAY);
+    xSemaphoreTake(io->stopped, portMAX_DELAY);
+    vQueueDelete(io->queue);
+    vSemaphoreDelete(io->stopped);
+    free(io);
+}
+
+bool asyncsmp_io_submit(asyncsmp_io_t *io, asyncsmp_req_t *req, TickType_t ticks)
+{
+    if (!req)
+        return false;
+    asyncsmp_req_reset(req);
+    return xQueueSendToBack(io->queue, &req, ticks) == pdTRUE;
+}
+
+void asyncsmp_io_stats(asyncsmp_io_t *io, asyncsmp_io_stats_t *stats)
+{
+    stats->ops = __atomic_load_n(&io->ops, __ATOMIC_RELAXED);
+    stats->batches = __atomic_load_n(&io->batches, __ATOMIC_RELAXED);
+    stats->calls = __atomic_load_n(&io->calls, __ATOMIC_RELAXED);
+}
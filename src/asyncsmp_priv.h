@@ -0,0 +1,73 @@
+/**
+ * Copyright 2021 Michele Riva
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#pragma once
+
+#include <asyncsmp.h>
+
+/**
+ * @brief Request state flags
+ */
+#define ASYNCSMP_STATE_DONE 0x01    // Completed, not yet consumed by an awaiter
+#define ASYNCSMP_STATE_TIMED 0x02   // A timer is armed on the request
+#define ASYNCSMP_STATE_EXPIRED 0x04 // Completed by a deadline, the late callback will be ignored
+#define ASYNCSMP_STATE_STALLED 0x08 // Reported as stalled by the registry
+#define ASYNCSMP_STATE_BLOCKED 0x10 // A semaphore request awaiter is blocked on the semaphore in cb_args
+#define ASYNCSMP_STATE_CANCELLED 0x20 // A copy of a hedged request lost, its answer will be discarded
+#define ASYNCSMP_STATE_ARGS 0x40      // Callback arguments were allocated with the request, and are released with it
+#define ASYNCSMP_STATE_FIRING 0x80    // Claimed by an expiring delayed callback, a concurrent callback will be ignored
+
+/**
+ * @brief Internal callback, bypassing timer checks
+ */
+void _asyncsmp_cb(asyncsmp_req_t *req, int8_t ret);
+
+/**
+ * @brief Internal timer claim
+ *
+ * Disarms the timer of a request about to be called back.
+ *
+ * @return true if the request can be called back, false if it was already completed by a deadline
+ */
+bool _asyncsmp_timer_claim(asyncsmp_req_t *req);
+
+/**
+ * @brief Internal request type name
+ */
+const char *_asyncsmp_req_type(asyncsmp_req_t *req);
+
+/**
+ * @brief Whether the request frees itself when called back
+ */
+bool _asyncsmp_req_noawait(asyncsmp_req_t *req);
+
+/**
+ * @brief Whether the request callback never blocks, and can run with the scheduler suspended
+ */
+bool _asyncsmp_req_batchable(asyncsmp_req_t *req);
+
+/**
+ * @brief Internal execution, calling done(ctx) once fn returns
+ */
+bool _asyncsmp_exec(asyncsmp_fn_t fn, asyncsmp_req_t *req, uint32_t stacksize, uint32_t priority, asyncsmp_affinity_t affinity, void (*done)(void *ctx), void *ctx);
+
+#if CONFIG_ASYNCSMP_REGISTRY
+/**
+ * @brief Internal registry hooks, called on allocation and release
+ */
+void _asyncsmp_registry_add(asyncsmp_req_t *req);
+void _asyncsmp_registry_remove(asyncsmp_req_t *req);
+#endif
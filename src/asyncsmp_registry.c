@@ -0,0 +1,316 @@
+/**
+ * Copyright 2021 Michele Riva
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#include <asyncsmp_registry.h>
+#include <esp_log.h>
+#include "asyncsmp_priv.h"
+
+#if CONFIG_ASYNCSMP_REGISTRY
+
+static const char *TAG = "asyncsmp";
+
+#define ASYNCSMP_REGISTRY_BATCH 16 // Requests visited per lock hold while walking a list
+
+/**
+ * @brief Per-core request lists
+ *
+ * Requests are added to the list of the allocating core, so that allocations on different
+ * cores never contend. Each list has its own lock, held only to link or unlink a request,
+ * or to walk a bounded batch of requests.
+ */
+typedef struct _asyncsmp_registry_list
+{
+    portMUX_TYPE lock;
+    asyncsmp_req_t *head;
+} _asyncsmp_registry_list_t;
+static _asyncsmp_registry_list_t _asyncsmp_registry[portNUM_PROCESSORS] = {
+    [0 ... portNUM_PROCESSORS - 1] = {.lock = portMUX_INITIALIZER_UNLOCKED}};
+
+typedef struct _asyncsmp_registry_watchdog
+{
+    TickType_t threshold;
+    TickType_t period;
+} _asyncsmp_registry_watchdog_t;
+static TaskHandle_t _asyncsmp_registry_watchdog;
+
+/**
+ * @brief Link a request before another one, or at the head of the list (lock held)
+ */
+static void _asyncsmp_registry_link(_asyncsmp_registry_list_t *list, asyncsmp_req_t *req, asyncsmp_req_t *next)
+{
+    req->registry.next = next;
+    req->registry.prev = next ? next->registry.prev : NULL;
+    if (req->registry.prev)
+        req->registry.prev->registry.next = req;
+    else
+        list->head = req;
+    if (next)
+        next->registry.prev = req;
+}
+
+/**
+ * @brief Unlink a request (lock held)
+ */
+static void _asyncsmp_registry_unlink(_asyncsmp_registry_list_t *list, asyncsmp_req_t *req)
+{
+    if (req->registry.prev)
+        req->registry.prev->registry.next = req->registry.next;
+    else
+        list->head = req->registry.next;
+    if (req->registry.next)
+        req->registry.next->registry.prev = req->registry.prev;
+}
+
+void _asyncsmp_registry_add(asyncsmp_req_t *req)
+{
+    req->registry.owner = xTaskGetCurrentTaskHandle();
+    req->registry.created = xTaskGetTickCount();
+    req->registry.list = xPortGetCoreID();
+    _asyncsmp_registry_list_t *list = &_asyncsmp_registry[req->registry.list];
+    portENTER_CRITICAL(&list->lock);
+    _asyncsmp_registry_link(list, req, list->head);
+    portEXIT_CRITICAL(&list->lock);
+}
+
+void _asyncsmp_registry_remove(asyncsmp_req_t *req)
+{
+    _asyncsmp_registry_list_t *list = &_asyncsmp_registry[req->registry.list];
+    portENTER_CRITICAL(&list->lock);
+    _asyncsmp_registry_unlink(list, req);
+    portEXIT_CRITICAL(&list->lock);
+}
+
+/**
+ * @brief Visit function, called with the list lock held
+ *
+ * @return true to stop walking
+ */
+typedef bool (*_asyncsmp_registry_visit_t)(asyncsmp_req_t *req, void *ctx);
+
+/**
+ * @brief Walk outstanding requests
+ *
+ * The lock of a list is held for at most ASYNCSMP_REGISTRY_BATCH requests at a time, so that allocations
+ * and releases on that core are not held up by long lists. Between batches the position is kept by a
+ * cursor linked in the list, which is told apart from requests by its missing allocator.
+ */
+static void _asyncsmp_registry_walk(_asyncsmp_registry_visit_t visit, void *ctx)
+{
+    for (size_t i = 0; i < portNUM_PROCESSORS; i++)
+    {
+        _asyncsmp_registry_list_t *list = &_asyncsmp_registry[i];
+        asyncsmp_req_t cursor = {.allocator = NULL};
+        asyncsmp_req_t *req;
+        bool stop = false;
+
+        portENTER_CRITICAL(&list->lock);
+        _asyncsmp_registry_link(list, &cursor, list->head);
+        portEXIT_CRITICAL(&list->lock);
+        do
+        {
+            portENTER_CRITICAL(&list->lock);
+            req = cursor.registry.next;
+            for (size_t n = 0; req && n < ASYNCSMP_REGISTRY_BATCH && !stop; n++)
+            {
+                if (req->allocator)
+                    stop = visit(req, ctx);
+                req = req->registry.next;
+            }
+            _asyncsmp_registry_unlink(list, &cursor);
+            if (req && !stop)
+                _asyncsmp_registry_link(list, &cursor, req);
+            portEXIT_CRITICAL(&list->lock);
+        } while (req && !stop);
+        if (stop)
+            return;
+    }
+}
+
+static void _asyncsmp_registry_info(asyncsmp_req_t *req, TickType_t now, asyncsmp_req_info_t *info)
+{
+    *info = (asyncsmp_req_info_t){
+        .req = req,
+        .type = _asyncsmp_req_type(req),
+        .owner = req->registry.owner,
+        .age = now - req->registry.created,
+        .parent = req->parent};
+}
+
+typedef struct _asyncsmp_registry_collect
+{
+    asyncsmp_req_info_t *infos;
+    size_t len;
+    size_t count;
+    TickType_t now;
+    TickType_t min_age;
+    bool stalled;
+} _asyncsmp_registry_collect_t;
+
+static bool _asyncsmp_registry_visit_collect(asyncsmp_req_t *req, void *ctx)
+{
+    _asyncsmp_registry_collect_t *collect = ctx;
+    if (collect->now - req->registry.created < collect->min_age)
+        return false;
+    if (collect->stalled && __atomic_fetch_or(&req->state, ASYNCSMP_STATE_STALLED, __ATOMIC_SEQ_CST) & ASYNCSMP_STATE_STALLED)
+        return false;
+    _asyncsmp_registry_info(req, collect->now, &collect->infos[collect->count++]);
+    return collect->count >= collect->len;
+}
+
+/**
+ * @brief Collect outstanding requests
+ *
+ * Request fields are copied while the list lock is held, as requests may be released right after.
+ * If stalled is set, requests already reported are skipped and the others are marked as reported.
+ */
+static size_t _asyncsmp_registry_collect(asyncsmp_req_info_t *infos, size_t len, TickType_t min_age, bool stalled)
+{
+    _asyncsmp_registry_collect_t collect = {
+        .infos = infos,
+        .len = len,
+        .now = xTaskGetTickCount(),
+        .min_age = min_age,
+        .stalled = stalled};
+    if (len)
+        _asyncsmp_registry_walk(_asyncsmp_registry_visit_collect, &collect);
+    return collect.count;
+}
+
+typedef struct _asyncsmp_registry_find
+{
+    asyncsmp_req_t *target;
+    asyncsmp_req_info_t *info;
+    TickType_t now;
+    bool found;
+} _asyncsmp_registry_find_t;
+
+static bool _asyncsmp_registry_visit_find(asyncsmp_req_t *req, void *ctx)
+{
+    _asyncsmp_registry_find_t *find = ctx;
+    if (req != find->target)
+        return false;
+    _asyncsmp_registry_info(req, find->now, find->info);
+    find->found = true;
+    return true;
+}
+
+/**
+ * @brief Look up an outstanding request
+ *
+ * @return true if the request is still outstanding, in which case info is filled
+ */
+static bool _asyncsmp_registry_find(asyncsmp_req_t *target, asyncsmp_req_info_t *info)
+{
+    _asyncsmp_registry_find_t find = {
+        .target = target,
+        .info = info,
+        .now = xTaskGetTickCount()};
+    _asyncsmp_registry_walk(_asyncsmp_registry_visit_find, &find);
+    return find.found;
+}
+
+/**
+ * @brief Log a request and its parent chain
+ */
+static void _asyncsmp_registry_log(const asyncsmp_req_info_t *info)
+{
+    ESP_LOGW(TAG, "Request %p (%s) outstanding for %u ms, owner %p", info->req, info->type, (unsigned)(info->age * portTICK_PERIOD_MS), info->owner);
+    asyncsmp_req_info_t parent = *info;
+    while (parent.parent)
+    {
+        asyncsmp_req_t *req = parent.parent;
+        if (!_asyncsmp_registry_find(req, &parent))
+        {
+            ESP_LOGW(TAG, "  parent %p (released)", req);
+            break;
+        }
+        ESP_LOGW(TAG, "  parent %p (%s) outstanding for %u ms, owner %p", parent.req, parent.type, (unsigned)(parent.age * portTICK_PERIOD_MS), parent.owner);
+    }
+}
+
+size_t asyncsmp_registry_list(asyncsmp_req_info_t *infos, size_t len, TickType_t min_age)
+{
+    return _asyncsmp_registry_collect(infos, len, min_age, false);
+}
+
+void asyncsmp_registry_dump(TickType_t min_age)
+{
+    asyncsmp_req_info_t infos[8];
+    size_t count = _asyncsmp_registry_collect(infos, 8, min_age, false);
+    for (size_t i = 0; i < count; i++)
+        _asyncsmp_registry_log(&infos[i]);
+}
+
+/**
+ * @brief Stall detector task
+ */
+static void _asyncsmp_registry_watchdog_task(void *args)
+{
+    _asyncsmp_registry_watchdog_t watchdog = *(_asyncsmp_registry_watchdog_t *)args;
+    free(args);
+    asyncsmp_req_info_t infos[8];
+    while (true)
+    {
+        vTaskDelay(watchdog.period);
+        size_t count;
+        do
+        {
+            count = _asyncsmp_registry_collect(infos, 8, watchdog.threshold, true);
+            for (size_t i = 0; i < count; i++)
+                _asyncsmp_registry_log(&infos[i]);
+        } while (count == 8);
+    }
+}
+
+bool asyncsmp_registry_watchdog_start(TickType_t threshold, TickType_t period, uint32_t stacksize, uint32_t priority)
+{
+    if (_asyncsmp_registry_watchdog)
+        return true;
+    _asyncsmp_registry_watchdog_t *args = malloc(sizeof(_asyncsmp_registry_watchdog_t));
+    if (!args)
+        return false;
+    args->threshold = threshold;
+    args->period = period;
+    if (xTaskCreate(
+            _asyncsmp_registry_watchdog_task,
+            "asyncsmp_watchdog",
+            stacksize,
+            args,
+            priority,
+            &_asyncsmp_registry_watchdog) != pdTRUE)
+    {
+        free(args);
+        return false;
+    }
+    return true;
+}
+
+#else
+
+size_t asyncsmp_registry_list(asyncsmp_req_info_t *infos, size_t len, TickType_t min_age)
+{
+    return 0;
+}
+
+void asyncsmp_registry_dump(TickType_t min_age)
+{
+}
+
+bool asyncsmp_registry_watchdog_start(TickType_t threshold, TickType_t period, uint32_t stacksize, uint32_t priority)
+{
+    return false;
+}
+
+#endif
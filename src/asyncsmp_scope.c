@@ -0,0 +1,180 @@
+/**
+ * Copyright 2021 Michele Riva
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#include <asyncsmp_scope.h>
+#include "asyncsmp_priv.h"
+
+#define ASYNCSMP_SCOPE_ALIGN(size) (((size) + 7) & ~(size_t)7)
+
+/**
+ * @brief Memory chunk
+ *
+ * Chunks are zeroed when allocated and never reused, so bumped memory needs no clearing.
+ */
+typedef struct _asyncsmp_scope_chunk
+{
+    struct _asyncsmp_scope_chunk *next;
+    size_t size;
+    size_t used;
+    uint8_t mem[] __attribute__((aligned(8)));
+} _asyncsmp_scope_chunk_t;
+
+struct asyncsmp_scope
+{
+    asyncsmp_allocator_t allocator;
+    portMUX_TYPE lock;
+    size_t chunk_size;
+    _asyncsmp_scope_chunk_t *chunks;
+    uint32_t started;
+    uint32_t joined;
+    SemaphoreHandle_t done;
+};
+
+static _asyncsmp_scope_chunk_t *_asyncsmp_scope_chunk_alloc(size_t size)
+{
+    _asyncsmp_scope_chunk_t *chunk = calloc(1, sizeof(_asyncsmp_scope_chunk_t) + size);
+    if (chunk)
+        chunk->size = size;
+    return chunk;
+}
+
+/**
+ * @brief Bump allocation (lock held)
+ */
+static void *_asyncsmp_scope_bump(_asyncsmp_scope_chunk_t *chunk, size_t size)
+{
+    if (!chunk || chunk->size - chunk->used < size)
+        return NULL;
+    void *ptr = chunk->mem + chunk->used;
+    chunk->used += size;
+    return ptr;
+}
+
+static void *_asyncsmp_scope_alloc(asyncsmp_mem_t mem, size_t size, void *ctx)
+{
+    asyncsmp_scope_t *scope = ctx;
+    size = ASYNCSMP_SCOPE_ALIGN(size);
+
+    portENTER_CRITICAL(&scope->lock);
+    void *ptr = _asyncsmp_scope_bump(scope->chunks, size);
+    portEXIT_CRITICAL(&scope->lock);
+    if (ptr)
+        return ptr;
+
+    // Chunks are allocated outside of the lock, oversized allocations get a chunk of their own
+    _asyncsmp_scope_chunk_t *chunk = _asyncsmp_scope_chunk_alloc(size > scope->chunk_size ? size : scope->chunk_size);
+    if (!chunk)
+        return NULL;
+    portENTER_CRITICAL(&scope->lock);
+    ptr = _asyncsmp_scope_bump(chunk, size);
+    if (size > scope->chunk_size)
+    {
+        // Keep bumping from the current chunk
+        chunk->next = scope->chunks->next;
+        scope->chunks->next = chunk;
+    }
+    else
+    {
+        chunk->next = scope->chunks;
+        scope->chunks = chunk;
+    }
+    portEXIT_CRITICAL(&scope->lock);
+    return ptr;
+}
+
+asyncsmp_scope_t *asyncsmp_scope_create(size_t chunk_size)
+{
+    asyncsmp_scope_t *scope = calloc(1, sizeof(asyncsmp_scope_t));
+    if (!scope)
+        return NULL;
+    scope->done = xSemaphoreCreateCounting(UINT32_MAX, 0);
+    scope->chunks = _asyncsmp_scope_chunk_alloc(chunk_size);
+    if (!scope->done || !scope->chunks)
+    {
+        if (scope->done)
+            vSemaphoreDelete(scope->done);
+        free(scope->chunks);
+        free(scope);
+        return NULL;
+    }
+    scope->allocator.alloc = _asyncsmp_scope_alloc;
+    scope->allocator.ctx = scope;
+    portMUX_INITIALIZE(&scope->lock);
+    scope->chunk_size = chunk_size;
+    return scope;
+}
+
+const asyncsmp_allocator_t *asyncsmp_scope_allocator(asyncsmp_scope_t *scope)
+{
+    return &scope->allocator;
+}
+
+/**
+ * @brief Executed function completion
+ *
+ * The scope is not touched after giving, as it may be closed right after.
+ */
+static void _asyncsmp_scope_done(void *ctx)
+{
+    asyncsmp_scope_t *scope = ctx;
+    xSemaphoreGive(scope->done);
+}
+
+bool asyncsmp_scope_exec(asyncsmp_scope_t *scope, asyncsmp_fn_t fn, asyncsmp_req_t *req, uint32_t stacksize, uint32_t priority)
+{
+    __atomic_fetch_add(&scope->started, 1, __ATOMIC_SEQ_CST);
+    if (_asyncsmp_exec(fn, req, stacksize, priority, ASYNCSMP_AFFINITY_ANY, _asyncsmp_scope_done, scope))
+        return true;
+    _asyncsmp_scope_done(scope);
+    return false;
+}
+
+bool asyncsmp_scope_join(asyncsmp_scope_t *scope, TickType_t ticks)
+{
+    // Functions may start others within the scope, so the count is checked again after each take
+    TickType_t start = xTaskGetTickCount();
+    while (scope->joined != __atomic_load_n(&scope->started, __ATOMIC_SEQ_CST))
+    {
+        TickType_t wait = portMAX_DELAY;
+        if (ticks != portMAX_DELAY)
+        {
+            TickType_t elapsed = xTaskGetTickCount() - start;
+            if (elapsed >= ticks)
+                return false;
+            wait = ticks - elapsed;
+        }
+        if (xSemaphoreTake(scope->done, wait) != pdTRUE)
+            return false;
+        scope->joined++;
+    }
+    return true;
+}
+
+bool asyncsmp_scope_close(asyncsmp_scope_t *scope, TickType_t ticks)
+{
+    if (!scope)
+        return true;
+    if (!asyncsmp_scope_join(scope, ticks))
+        return false;
+    while (scope->chunks)
+    {
+        _asyncsmp_scope_chunk_t *next = scope->chunks->next;
+        free(scope->chunks);
+        scope->chunks = next;
+    }
+    vSemaphoreDelete(scope->done);
+    free(scope);
+    return true;
+}
@@ -0,0 +1,348 @@
+/**
+ * Copyright 2021 Michele Riva
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#include <asyncsmp_shm.h>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#define ASYNCSMP_SHM_MAGIC 0x504D5341 // "ASMP"
+#define ASYNCSMP_SHM_VERSION 1
+#define ASYNCSMP_SHM_LINE 64
+#define ASYNCSMP_SHM_ALIGN(size) (((size) + ASYNCSMP_SHM_LINE - 1) & ~(size_t)(ASYNCSMP_SHM_LINE - 1))
+
+/**
+ * @brief Ring cell
+ *
+ * The sequence number tells producers and the consumer whose turn it is (bounded MPSC queue after D. Vyukov).
+ */
+typedef struct _asyncsmp_shm_cell
+{
+    uint32_t seq;
+    asyncsmp_enum_t type;
+    uint32_t offset;
+} _asyncsmp_shm_cell_t;
+
+/**
+ * @brief Endpoint message ring
+ *
+ * Rings have room for every slot of the slab, so producers never wait for space.
+ * The consumer sleeps on the signal futex word, which producers bump after each push.
+ */
+typedef struct _asyncsmp_shm_ring
+{
+    _Alignas(ASYNCSMP_SHM_LINE) uint32_t enqueue;
+    _Alignas(ASYNCSMP_SHM_LINE) uint32_t dequeue;
+    uint32_t signal;
+    uint32_t waiters;
+    _Alignas(ASYNCSMP_SHM_LINE) _asyncsmp_shm_cell_t cells[];
+} _asyncsmp_shm_ring_t;
+
+/**
+ * @brief Shared memory object header
+ *
+ * The free list head packs the index (+1) of the first free slot with a tag, bumped on each update against ABA.
+ */
+typedef struct _asyncsmp_shm_header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;
+    uint32_t slots;
+    uint32_t slot_size;
+    uint32_t ring_mask;
+    uint32_t ring_size;
+    uint32_t rings;
+    uint32_t slab;
+    uint16_t endpoints;
+    _Alignas(ASYNCSMP_SHM_LINE) uint64_t free;
+} _asyncsmp_shm_header_t;
+
+struct asyncsmp_shm
+{
+    _asyncsmp_shm_header_t *header;
+    size_t size;
+};
+
+static inline _asyncsmp_shm_ring_t *_asyncsmp_shm_ring(asyncsmp_shm_t *shm, uint16_t endpoint)
+{
+    return (_asyncsmp_shm_ring_t *)((uint8_t *)shm->header + shm->header->rings + endpoint * shm->header->ring_size);
+}
+
+static inline asyncsmp_shm_req_t *_asyncsmp_shm_slot(asyncsmp_shm_t *shm, uint32_t index)
+{
+    return (asyncsmp_shm_req_t *)((uint8_t *)shm->header + shm->header->slab + index * shm->header->slot_size);
+}
+
+static asyncsmp_shm_t *_asyncsmp_shm_map(int fd, size_t size)
+{
+    asyncsmp_shm_t *shm = malloc(sizeof(asyncsmp_shm_t));
+    if (!shm)
+        return NULL;
+    shm->header = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (shm->header == MAP_FAILED)
+    {
+        free(shm);
+        return NULL;
+    }
+    shm->size = size;
+    return shm;
+}
+
+asyncsmp_shm_t *asyncsmp_shm_create(const char *name, uint16_t endpoints, uint32_t slots, size_t data_size)
+{
+    if (!endpoints || !slots)
+        return NULL;
+
+    uint32_t ring_len = 1;
+    while (ring_len < slots)
+        ring_len <<= 1;
+    size_t ring_size = ASYNCSMP_SHM_ALIGN(sizeof(_asyncsmp_shm_ring_t) + ring_len * sizeof(_asyncsmp_shm_cell_t));
+    size_t slot_size = ASYNCSMP_SHM_ALIGN(sizeof(asyncsmp_shm_req_t) + data_size);
+    size_t rings = ASYNCSMP_SHM_ALIGN(sizeof(_asyncsmp_shm_header_t));
+    size_t slab = rings + endpoints * ring_size;
+    size_t size = slab + (size_t)slots * slot_size;
+    if (size > UINT32_MAX)
+        return NULL;
+
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0)
+        return NULL;
+    asyncsmp_shm_t *shm = ftruncate(fd, size) ? NULL : _asyncsmp_shm_map(fd, size);
+    close(fd);
+    if (!shm)
+    {
+        shm_unlink(name);
+        return NULL;
+    }
+
+    // The object is zero-filled, only non-zero fields are initialized
+    _asyncsmp_shm_header_t *header = shm->header;
+    header->version = ASYNCSMP_SHM_VERSION;
+    header->size = size;
+    header->slots = slots;
+    header->slot_size = slot_size;
+    header->ring_mask = ring_len - 1;
+    header->ring_size = ring_size;
+    header->rings = rings;
+    header->slab = slab;
+    header->endpoints = endpoints;
+    for (uint16_t i = 0; i < endpoints; i++)
+    {
+        _asyncsmp_shm_ring_t *ring = _asyncsmp_shm_ring(shm, i);
+        for (uint32_t j = 0; j < ring_len; j++)
+            ring->cells[j].seq = j;
+    }
+    for (uint32_t i = 0; i + 1 < slots; i++)
+        _asyncsmp_shm_slot(shm, i)->next = i + 2;
+    header->free = 1;
+
+    // Publish
+    __atomic_store_n(&header->magic, ASYNCSMP_SHM_MAGIC, __ATOMIC_RELEASE);
+    return shm;
+}
+
+asyncsmp_shm_t *asyncsmp_shm_attach(const char *name)
+{
+    int fd = shm_open(name, O_RDWR, 0600);
+    if (fd < 0)
+        return NULL;
+    struct stat st;
+    asyncsmp_shm_t *shm = NULL;
+    if (!fstat(fd, &st) && (size_t)st.st_size >= sizeof(_asyncsmp_shm_header_t))
+        shm = _asyncsmp_shm_map(fd, st.st_size);
+    close(fd);
+    if (!shm)
+        return NULL;
+
+    _asyncsmp_shm_header_t *header = shm->header;
+    if (__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != ASYNCSMP_SHM_MAGIC || header->version != ASYNCSMP_SHM_VERSION || header->size != shm->size)
+    {
+        asyncsmp_shm_detach(shm);
+        return NULL;
+    }
+    return shm;
+}
+
+void asyncsmp_shm_detach(asyncsmp_shm_t *shm)
+{
+    if (!shm)
+        return;
+    munmap(shm->header, shm->size);
+    free(shm);
+}
+
+void asyncsmp_shm_unlink(const char *name)
+{
+    shm_unlink(name);
+}
+
+asyncsmp_shm_req_t *asyncsmp_shm_req_alloc(asyncsmp_shm_t *shm, uint16_t reply_to, asyncsmp_enum_t reply_type, size_t data_size)
+{
+    _asyncsmp_shm_header_t *header = shm->header;
+    if (sizeof(asyncsmp_shm_req_t) + data_size > header->slot_size)
+        return NULL;
+
+    // Pop from the free list. A stale next link is harmless, as the tag makes the exchange fail
+    asyncsmp_shm_req_t *req;
+    uint64_t head = __atomic_load_n(&header->free, __ATOMIC_ACQUIRE);
+    uint64_t next;
+    do
+    {
+        uint32_t index = (uint32_t)head;
+        if (!index)
+            return NULL;
+        req = _asyncsmp_shm_slot(shm, index - 1);
+        next = ((head >> 32) + 1) << 32 | __atomic_load_n(&req->next, __ATOMIC_RELAXED);
+    } while (!__atomic_compare_exchange_n(&header->free, &head, next, true, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+    memset(req, 0, sizeof(asyncsmp_shm_req_t) + data_size);
+    req->reply_to = reply_to;
+    req->reply_type = reply_type;
+    return req;
+}
+
+void asyncsmp_shm_req_free(asyncsmp_shm_t *shm, asyncsmp_shm_req_t *req)
+{
+    if (!req)
+        return;
+    _asyncsmp_shm_header_t *header = shm->header;
+    uint32_t index = (asyncsmp_shm_offset(shm, req) - header->slab) / header->slot_size + 1;
+    uint64_t head = __atomic_load_n(&header->free, __ATOMIC_RELAXED);
+    uint64_t next;
+    do
+    {
+        __atomic_store_n(&req->next, (uint32_t)head, __ATOMIC_RELAXED);
+        next = ((head >> 32) + 1) << 32 | index;
+    } while (!__atomic_compare_exchange_n(&header->free, &head, next, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+bool asyncsmp_shm_send(asyncsmp_shm_t *shm, uint16_t endpoint, asyncsmp_enum_t msg_type, asyncsmp_shm_req_t *req)
+{
+    if (endpoint >= shm->header->endpoints)
+        return false;
+    _asyncsmp_shm_ring_t *ring = _asyncsmp_shm_ring(shm, endpoint);
+    uint32_t mask = shm->header->ring_mask;
+
+    // Claim a cell
+    _asyncsmp_shm_cell_t *cell;
+    uint32_t pos = __atomic_load_n(&ring->enqueue, __ATOMIC_RELAXED);
+    while (true)
+    {
+        cell = &ring->cells[pos & mask];
+        uint32_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        if (seq == pos)
+        {
+            if (__atomic_compare_exchange_n(&ring->enqueue, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        }
+        else
+        {
+            pos = __atomic_load_n(&ring->enqueue, __ATOMIC_RELAXED);
+        }
+    }
+    cell->type = msg_type;
+    cell->offset = asyncsmp_shm_offset(shm, req);
+    __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+
+    // Wake up the receiver, if sleeping
+    __atomic_fetch_add(&ring->signal, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ring->waiters, __ATOMIC_SEQ_CST))
+        syscall(SYS_futex, &ring->signal, FUTEX_WAKE, 1, NULL, NULL, 0);
+    return true;
+}
+
+/**
+ * @brief Pop a message from a ring (single consumer)
+ */
+static bool _asyncsmp_shm_pop(asyncsmp_shm_t *shm, _asyncsmp_shm_ring_t *ring, asyncsmp_shm_msg_t *msg)
+{
+    uint32_t mask = shm->header->ring_mask;
+    uint32_t pos = __atomic_load_n(&ring->dequeue, __ATOMIC_RELAXED);
+    _asyncsmp_shm_cell_t *cell = &ring->cells[pos & mask];
+    if (__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) != pos + 1)
+        return false;
+    msg->type = cell->type;
+    msg->req = asyncsmp_shm_ptr(shm, cell->offset);
+    __atomic_store_n(&cell->seq, pos + mask + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&ring->dequeue, pos + 1, __ATOMIC_RELAXED);
+    return true;
+}
+
+bool asyncsmp_shm_receive(asyncsmp_shm_t *shm, uint16_t endpoint, asyncsmp_shm_msg_t *msg, uint32_t timeout_ms)
+{
+    if (endpoint >= shm->header->endpoints)
+        return false;
+    _asyncsmp_shm_ring_t *ring = _asyncsmp_shm_ring(shm, endpoint);
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    int64_t deadline_ns = deadline.tv_sec * 1000000000LL + deadline.tv_nsec + timeout_ms * 1000000LL;
+
+    while (!_asyncsmp_shm_pop(shm, ring, msg))
+    {
+        if (!timeout_ms)
+            return false;
+
+        // Flag as waiting, then check again not to miss a push in between
+        uint32_t signal = __atomic_load_n(&ring->signal, __ATOMIC_SEQ_CST);
+        __atomic_fetch_add(&ring->waiters, 1, __ATOMIC_SEQ_CST);
+        if (_asyncsmp_shm_pop(shm, ring, msg))
+        {
+            __atomic_fetch_sub(&ring->waiters, 1, __ATOMIC_SEQ_CST);
+            return true;
+        }
+
+        struct timespec remaining;
+        struct timespec *timeout = NULL;
+        if (timeout_ms != ASYNCSMP_SHM_FOREVER)
+        {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            int64_t left = deadline_ns - (now.tv_sec * 1000000000LL + now.tv_nsec);
+            if (left <= 0)
+            {
+                __atomic_fetch_sub(&ring->waiters, 1, __ATOMIC_SEQ_CST);
+                return false;
+            }
+            remaining.tv_sec = left / 1000000000LL;
+            remaining.tv_nsec = left % 1000000000LL;
+            timeout = &remaining;
+        }
+        syscall(SYS_futex, &ring->signal, FUTEX_WAIT, signal, timeout, NULL, 0);
+        __atomic_fetch_sub(&ring->waiters, 1, __ATOMIC_SEQ_CST);
+    }
+    return true;
+}
+
+void asyncsmp_shm_cb(asyncsmp_shm_t *shm, asyncsmp_shm_req_t *req, int8_t ret)
+{
+    req->ret = ret;
+    asyncsmp_shm_send(shm, req->reply_to, req->reply_type, req);
+}
+
+uint32_t asyncsmp_shm_offset(asyncsmp_shm_t *shm, const void *ptr)
+{
+    return ptr ? (uint32_t)((const uint8_t *)ptr - (const uint8_t *)shm->header) : 0;
+}
+
+void *asyncsmp_shm_ptr(asyncsmp_shm_t *shm, uint32_t offset)
+{
+    return offset ? (uint8_t *)shm->header + offset : NULL;
+}
@@ -0,0 +1,360 @@
+/**
+ * Copyright 2021 Michele Riva
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#include <asyncsmp_timer.h>
+#include "asyncsmp_priv.h"
+
+/**
+ * @brief Timing wheel geometry
+ *
+ * Four levels of 64 slots cover 2^24 ticks. Timers further in the future are parked
+ * in the last level and moved down as the wheel turns.
+ */
+#define ASYNCSMP_TIMER_LEVELS 4
+#define ASYNCSMP_TIMER_BITS 6
+#define ASYNCSMP_TIMER_SLOTS (1 << ASYNCSMP_TIMER_BITS)
+#define ASYNCSMP_TIMER_MASK (ASYNCSMP_TIMER_SLOTS - 1)
+#define ASYNCSMP_TIMER_SPAN (((TickType_t)1 << (ASYNCSMP_TIMER_BITS * ASYNCSMP_TIMER_LEVELS)) - 1)
+
+typedef struct _asyncsmp_timer_entry
+{
+    struct _asyncsmp_timer_entry *next;
+    struct _asyncsmp_timer_entry **pprev;
+    asyncsmp_req_t *req;
+    TickType_t expiry;
+    int8_t ret;
+    bool deadline;
+} _asyncsmp_timer_entry_t;
+
+#define ASYNCSMP_TIMER_IDLE 0
+#define ASYNCSMP_TIMER_STARTING 1
+#define ASYNCSMP_TIMER_RUNNING 2
+
+typedef struct _asyncsmp_timer
+{
+    portMUX_TYPE lock;
+    TaskHandle_t task;
+    uint8_t state;
+    TickType_t now;
+    TickType_t wake;
+    uint8_t pending;
+    bool idle;
+    size_t count;
+    _asyncsmp_timer_entry_t *pool;
+    _asyncsmp_timer_entry_t *slots[ASYNCSMP_TIMER_LEVELS][ASYNCSMP_TIMER_SLOTS];
+} _asyncsmp_timer_t;
+
+static _asyncsmp_timer_t _asyncsmp_timer = {
+    .lock = portMUX_INITIALIZER_UNLOCKED,
+    .idle = true};
+
+static void _asyncsmp_timer_task(void *args);
+
+/**
+ * @brief Insert entry in the wheel
+ *
+ * Entries are placed in the lowest level whose span covers their distance from the wheel time.
+ */
+static void _asyncsmp_timer_insert(_asyncsmp_timer_entry_t *entry)
+{
+    TickType_t delta = entry->expiry - _asyncsmp_timer.now;
+    if ((int32_t)delta <= 0)
+        delta = 1;
+    else if (delta > ASYNCSMP_TIMER_SPAN)
+        delta = ASYNCSMP_TIMER_SPAN;
+    TickType_t at = _asyncsmp_timer.now + delta;
+
+    size_t level = 0;
+    while (level < ASYNCSMP_TIMER_LEVELS - 1 && delta >> (ASYNCSMP_TIMER_BITS * (level + 1)))
+        level++;
+    _asyncsmp_timer_entry_t **slot = &_asyncsmp_timer.slots[level][(at >> (ASYNCSMP_TIMER_BITS * level)) & ASYNCSMP_TIMER_MASK];
+
+    entry->next = *slot;
+    if (entry->next)
+        entry->next->pprev = &entry->next;
+    entry->pprev = slot;
+    *slot = entry;
+}
+
+/**
+ * @brief Unlink entry from the wheel
+ */
+static void _asyncsmp_timer_unlink(_asyncsmp_timer_entry_t *entry)
+{
+    *entry->pprev = entry->next;
+    if (entry->next)
+        entry->next->pprev = entry->pprev;
+}
+
+/**
+ * @brief Detach entry from its request
+ */
+static void _asyncsmp_timer_detach(_asyncsmp_timer_entry_t *entry)
+{
+    entry->req->timer = NULL;
+    __atomic_fetch_and(&entry->req->state, ~ASYNCSMP_STATE_TIMED, __ATOMIC_SEQ_CST);
+    _asyncsmp_timer.count--;
+}
+
+/**
+ * @brief Expire entry
+ *
+ * Expired entries are detached from their request and collected in a list to be fired outside of the lock.
+ * The request is claimed by the timer before being detached, so that a callback racing with the timer is ignored.
+ */
+static void _asyncsmp_timer_expire(_asyncsmp_timer_entry_t *entry, _asyncsmp_timer_entry_t **expired)
+{
+    __atomic_fetch_or(&entry->req->state, entry->deadline ? ASYNCSMP_STATE_EXPIRED : ASYNCSMP_STATE_FIRING, __ATOMIC_SEQ_CST);
+    _asyncsmp_timer_detach(entry);
+    entry->next = *expired;
+    *expired = entry;
+}
+
+/**
+ * @brief Turn the wheel by one step
+ *
+ * Moving to the next tick flags the slots to process: the current slot of every level which wrapped around,
+ * to be cascaded down, then the current slot of the first level, to be expired. Each step processes a single
+ * slot, so that the lock is never held for more than one slot at a time while catching up.
+ *
+ * @return false if the wheel is up to date with tick
+ */
+static bool _asyncsmp_timer_step(TickType_t tick, _asyncsmp_timer_entry_t **expired)
+{
+    if (!_asyncsmp_timer.pending)
+    {
+        if (!_asyncsmp_timer.count || (int32_t)(tick - _asyncsmp_timer.now) <= 0)
+            return false;
+        _asyncsmp_timer.now++;
+        _asyncsmp_timer.pending = 1;
+        for (size_t level = 1; level < ASYNCSMP_TIMER_LEVELS; level++)
+        {
+            if ((_asyncsmp_timer.now >> (ASYNCSMP_TIMER_BITS * (level - 1))) & ASYNCSMP_TIMER_MASK)
+                break;
+            _asyncsmp_timer.pending |= 1 << level;
+        }
+    }
+
+    // Upper levels are cascaded first, from the lowest one
+    uint8_t upper = _asyncsmp_timer.pending & ~1;
+    size_t level = upper ? __builtin_ctz(upper) : 0;
+    _asyncsmp_timer.pending &= ~(1 << level);
+
+    _asyncsmp_timer_entry_t **slot = &_asyncsmp_timer.slots[level][(_asyncsmp_timer.now >> (ASYNCSMP_TIMER_BITS * level)) & ASYNCSMP_TIMER_MASK];
+    _asyncsmp_timer_entry_t *entry = *slot;
+    *slot = NULL;
+    while (entry)
+    {
+        _asyncsmp_timer_entry_t *next = entry->next;
+        if (!level || (int32_t)(entry->expiry - _asyncsmp_timer.now) <= 0)
+            _asyncsmp_timer_expire(entry, expired);
+        else
+            _asyncsmp_timer_insert(entry);
+        entry = next;
+    }
+    return true;
+}
+
+/**
+ * @brief Ticks until the wheel needs to turn again
+ *
+ * That is the next non-empty slot of the first level, or the next cascade.
+ */
+static TickType_t _asyncsmp_timer_next(void)
+{
+    TickType_t cascade = ASYNCSMP_TIMER_SLOTS - (_asyncsmp_timer.now & ASYNCSMP_TIMER_MASK);
+    for (TickType_t delta = 1; delta < cascade; delta++)
+    {
+        if (_asyncsmp_timer.slots[0][(_asyncsmp_timer.now + delta) & ASYNCSMP_TIMER_MASK])
+            return delta;
+    }
+    return cascade;
+}
+
+bool asyncsmp_timer_init(uint32_t stacksize, uint32_t priority)
+{
+    // Only one caller starts the service, the others wait for it to be started
+    uint8_t state = ASYNCSMP_TIMER_IDLE;
+    while (!__atomic_compare_exchange_n(&_asyncsmp_timer.state, &state, ASYNCSMP_TIMER_STARTING, false, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+    {
+        if (state == ASYNCSMP_TIMER_RUNNING)
+            return true;
+        vTaskDelay(1);
+        state = ASYNCSMP_TIMER_IDLE;
+    }
+
+    TaskHandle_t task;
+    bool started = xTaskCreate(
+                       _asyncsmp_timer_task,
+                       "asyncsmp_timer_task",
+                       stacksize,
+                       NULL,
+                       priority,
+                       &task) == pdTRUE;
+    if (started)
+        __atomic_store_n(&_asyncsmp_timer.task, task, __ATOMIC_RELEASE);
+    __atomic_store_n(&_asyncsmp_timer.state, started ? ASYNCSMP_TIMER_RUNNING : ASYNCSMP_TIMER_IDLE, __ATOMIC_RELEASE);
+    return started;
+}
+
+/**
+ * @brief Arm a timer on a request
+ */
+static bool _asyncsmp_timer_arm(asyncsmp_req_t *req, int8_t ret, TickType_t ticks, bool deadline)
+{
+    if (!req || !__atomic_load_n(&_asyncsmp_timer.task, __ATOMIC_ACQUIRE))
+        return false;
+
+    portENTER_CRITICAL(&_asyncsmp_timer.lock);
+    _asyncsmp_timer_entry_t *entry = _asyncsmp_timer.pool;
+    if (entry)
+        _asyncsmp_timer.pool = entry->next;
+    portEXIT_CRITICAL(&_asyncsmp_timer.lock);
+    if (!entry)
+    {
+        entry = malloc(sizeof(_asyncsmp_timer_entry_t));
+        if (!entry)
+            return false;
+    }
+    entry->req = req;
+    entry->ret = ret;
+    entry->deadline = deadline;
+
+    portENTER_CRITICAL(&_asyncsmp_timer.lock);
+    if (req->timer)
+    {
+        entry->next = _asyncsmp_timer.pool;
+        _asyncsmp_timer.pool = entry;
+        portEXIT_CRITICAL(&_asyncsmp_timer.lock);
+        return false;
+    }
+    TickType_t tick = xTaskGetTickCount();
+    if (!_asyncsmp_timer.count)
+    {
+        _asyncsmp_timer.now = tick;
+        _asyncsmp_timer.pending = 0;
+    }
+    entry->expiry = tick + ticks;
+    _asyncsmp_timer_insert(entry);
+    _asyncsmp_timer.count++;
+    req->timer = entry;
+    // A delayed callback fired on an earlier round no longer claims the request
+    __atomic_fetch_and(&req->state, ~ASYNCSMP_STATE_FIRING, __ATOMIC_SEQ_CST);
+    __atomic_fetch_or(&req->state, ASYNCSMP_STATE_TIMED, __ATOMIC_SEQ_CST);
+    bool wake = _asyncsmp_timer.idle || (int32_t)(entry->expiry - _asyncsmp_timer.wake) < 0;
+    if (wake)
+        _asyncsmp_timer.idle = false;
+    portEXIT_CRITICAL(&_asyncsmp_timer.lock);
+
+    if (wake)
+        xTaskNotifyGive(_asyncsmp_timer.task);
+    return true;
+}
+
+bool asyncsmp_timer_cb_after(asyncsmp_req_t *req, int8_t ret, TickType_t ticks)
+{
+    return _asyncsmp_timer_arm(req, ret, ticks, false);
+}
+
+bool asyncsmp_timer_deadline(asyncsmp_req_t *req, int8_t ret, TickType_t ticks)
+{
+    return _asyncsmp_timer_arm(req, ret, ticks, true);
+}
+
+/**
+ * @brief Remove the timer armed on a request (lock held)
+ */
+static bool _asyncsmp_timer_remove(asyncsmp_req_t *req)
+{
+    _asyncsmp_timer_entry_t *entry = req->timer;
+    if (!entry)
+        return false;
+    _asyncsmp_timer_unlink(entry);
+    _asyncsmp_timer_detach(entry);
+    entry->next = _asyncsmp_timer.pool;
+    _asyncsmp_timer.pool = entry;
+    return true;
+}
+
+bool asyncsmp_timer_cancel(asyncsmp_req_t *req)
+{
+    portENTER_CRITICAL(&_asyncsmp_timer.lock);
+    bool cancelled = _asyncsmp_timer_remove(req);
+    portEXIT_CRITICAL(&_asyncsmp_timer.lock);
+    return cancelled;
+}
+
+bool _asyncsmp_timer_claim(asyncsmp_req_t *req)
+{
+    bool claimed = true;
+    portENTER_CRITICAL(&_asyncsmp_timer.lock);
+    if (!_asyncsmp_timer_remove(req) && __atomic_fetch_and(&req->state, ~(ASYNCSMP_STATE_EXPIRED | ASYNCSMP_STATE_FIRING), __ATOMIC_SEQ_CST) & (ASYNCSMP_STATE_EXPIRED | ASYNCSMP_STATE_FIRING))
+        claimed = false;
+    portEXIT_CRITICAL(&_asyncsmp_timer.lock);
+    return claimed;
+}
+
+/**
+ * @brief Fire expired timers, then return their entries to the pool
+ */
+static void _asyncsmp_timer_fire(_asyncsmp_timer_entry_t *expired)
+{
+    if (!expired)
+        return;
+    _asyncsmp_timer_entry_t *last = NULL;
+    for (_asyncsmp_timer_entry_t *entry = expired; entry; entry = entry->next)
+    {
+        _asyncsmp_cb(entry->req, entry->ret);
+        last = entry;
+    }
+    portENTER_CRITICAL(&_asyncsmp_timer.lock);
+    last->next = _asyncsmp_timer.pool;
+    _asyncsmp_timer.pool = expired;
+    portEXIT_CRITICAL(&_asyncsmp_timer.lock);
+}
+
+/**
+ * @brief Timer service task
+ *
+ * Turns the wheel up to the current tick one slot at a time, firing the timers expired
+ * by each slot as a batch outside of the lock. Then sleeps until the wheel needs to turn
+ * again or a nearer timer is armed.
+ */
+static void _asyncsmp_timer_task(void *args)
+{
+    while (true)
+    {
+        _asyncsmp_timer_entry_t *expired = NULL;
+        TickType_t sleep = portMAX_DELAY;
+
+        portENTER_CRITICAL(&_asyncsmp_timer.lock);
+        TickType_t tick = xTaskGetTickCount();
+        bool turned = _asyncsmp_timer_step(tick, &expired);
+        if (!turned)
+        {
+            if (_asyncsmp_timer.count)
+            {
+                _asyncsmp_timer.wake = _asyncsmp_timer.now + _asyncsmp_timer_next();
+                sleep = (int32_t)(_asyncsmp_timer.wake - tick) > 0 ? _asyncsmp_timer.wake - tick : 0;
+            }
+            _asyncsmp_timer.idle = !_asyncsmp_timer.count;
+        }
+        portEXIT_CRITICAL(&_asyncsmp_timer.lock);
+
+        _asyncsmp_timer_fire(expired);
+        if (!turned)
+            ulTaskNotifyTake(pdTRUE, sleep);
+    }
+}